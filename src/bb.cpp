@@ -30,11 +30,20 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
+#include <cstdio>
+#include <ctime>
 #include <sstream>
 #include <algorithm>
 #include <unistd.h>
+#include <limits.h>
+#include <stdlib.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <strings.h>
+
+#include "config.h"
 
 #include "restclient-cpp/connection.h"
 #include "restclient-cpp/restclient.h"
@@ -43,6 +52,11 @@
 #include "coding.h"
 #include "jsoncpp.h"
 #include "exceptions.h"
+#include "transfer.h"
+#include "journal.h"
+#include "listing.h"
+#include "list_reader.h"
+#include "json_writer.h"
 
 using namespace std;
 
@@ -72,7 +86,7 @@ namespace {
    using khi::ResponseError;
 
    const RestClient::Response& validate(const RestClient::Response& response) {
-      if (response.code == 200) {
+      if (response.code == 200 || response.code == 206 /* HTTP partial content */) {
          return response;
       }
       const Json& json = Json::load(response.body);
@@ -84,6 +98,71 @@ namespace {
       }
       throw ResponseError(response.code, "other_error", response.body);
    }
+
+   // header names are case insensitive, and arrive lower case over HTTP/2
+   string headerValue(const RestClient::HeaderFields& headers, const string& name) {
+      for (RestClient::HeaderFields::const_iterator iter = headers.begin(); iter != headers.end(); ++iter) {
+         if (strcasecmp(iter->first.c_str(), name.c_str()) == 0) {
+            return iter->second;
+         }
+      }
+      return "";
+   }
+
+   // an absolute path for a journal key, also for files not yet created
+   string absolute(const string& filepath) {
+      char resolved[PATH_MAX];
+      if (realpath(filepath.c_str(), resolved)) {
+         return resolved;
+      }
+      if (!filepath.empty() && filepath[0] != '/' && getcwd(resolved, sizeof(resolved))) {
+         return string(resolved) + "/" + filepath;
+      }
+      return filepath;
+   }
+
+   // where the bucket list is cached between invocations
+   string bucketCachePath() {
+      return Session::directory() + "/buckets";
+   }
+
+   // reopen a target left by an interrupted download, -1 when it is gone
+   // or no longer the size it was preallocated to
+   int reopen(const string& filepath, uint64_t totalBytes) {
+      int fd = open(filepath.c_str(), O_RDWR);
+      struct stat st;
+      if (fd >= 0 && (fstat(fd, &st) || static_cast<uint64_t>(st.st_size) != totalBytes)) {
+         close(fd);
+         fd = -1;
+      }
+      return fd;
+   }
+
+   // open the download target at its final size so each part can be written
+   // straight to its own offset, no temporary part files needed
+   int preallocate(const string& filepath, uint64_t totalBytes) {
+      int fd = open(filepath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+      if (fd < 0) {
+         throw std::runtime_error("could not create file " + filepath);
+      }
+      int err = -1;
+      errno = EOPNOTSUPP;
+#ifdef HAVE_FALLOCATE
+      // reserves the blocks up front, failing early when the disk is too small
+      err = totalBytes > 0 ? fallocate(fd, 0, 0, totalBytes) : 0;
+#endif
+      if (err) {
+         // only a filesystem that cannot reserve blocks gets a sparse file,
+         // anything else (a full disk above all) is reported now
+         if ((errno != EOPNOTSUPP && errno != ENOSYS) || ftruncate(fd, totalBytes)) {
+            const string reason = errno == ENOSPC ? "not enough space for " : "could not size file ";
+            close(fd);
+            unlink(filepath.c_str());
+            throw std::runtime_error(reason + filepath);
+         }
+      }
+      return fd;
+   }
 }
 
 namespace khi {
@@ -92,15 +171,30 @@ const string BB::API_URL_PATH = "/b2api/v1";
 const int BB::MINIMUM_PART_SIZE_BYTES = 100 * 1000000; // 100 MB
 const int BB::MINIMUM_SPLIT_SIZE_BYTES = BB::MINIMUM_PART_SIZE_BYTES * 2;
 const int BB::MAX_FILE_PARTS = 10000;
+const uint64_t BB::ABSOLUTE_MINIMUM_PART_SIZE_BYTES = 5 * 1000000; // 5 MB
+const uint64_t BB::MAXIMUM_PART_SIZE_BYTES = 5000ull * 1000000; // 5 GB
+const uint64_t BB::MINIMUM_DOWNLOAD_RANGE_BYTES = 4 * 1000000; // 4 MB
+const uint64_t BB::MAXIMUM_DOWNLOAD_RANGE_BYTES = 64 * 1000000; // 64 MB
+const int BB::DOWNLOAD_RANGES_PER_THREAD = 4;
+const int BB::SPLIT_PARTS_PER_THREAD = 4;
+const int BB::SPLIT_EXTRA_CALLS = 2;
+const int BB::SPLIT_BENEFIT_MARGIN = 2;
+const int BB::DEFAULT_DOWNLOAD_THREADS = 4;
+const size_t BB::DOWNLOAD_DIGEST_WINDOW_BYTES = 64 * 1000000; // 64 MB
+const uint64_t BB::STREAM_RANGE_BYTES = 8 * 1000000; // 8 MB
+const int BB::BUCKET_CACHE_TTL_SECONDS = 3600;
+const int BB::DEFAULT_BUCKET_THREADS = 4;
 const int BB::DEFAULT_UPLOAD_RETRY_ATTEMPTS = 5;
 
-UploadPartTask::UploadPartTask(const BB& bb, const string& fileId, const BB_Range& range, int index, const string& filepath)
+UploadPartTask::UploadPartTask(const BB& bb, const string& fileId, const BB_Range& range, int index, const string& filepath, Journal& journal)
    :  Task(NULL, "upload_part_task"),
       m_bb(bb),
       m_fileId(fileId),
       m_range(range),
       m_index(index),
-      m_filepath(filepath) { }
+      m_filepath(filepath),
+      m_journal(journal),
+      m_bytesRead(0) { }
 
 UploadPartTask::UploadPartTask(const UploadPartTask& other)
    :  Task(NULL, "upload_part_task"),
@@ -108,25 +202,41 @@ UploadPartTask::UploadPartTask(const UploadPartTask& other)
       m_fileId(other.m_fileId),
       m_range(other.m_range),
       m_index(other.m_index),
-      m_filepath(other.m_filepath) { }
+      m_filepath(other.m_filepath),
+      m_journal(other.m_journal),
+      m_bytesRead(other.m_bytesRead) { }
 
 UploadPartTask::~UploadPartTask() {
 }
 
 int UploadPartTask::run() {
+   Pool<vector<char> >::Lease buffer(m_bb.m_partBuffers);
+   Pool<BB::UploadUrlInfo>::Lease uploadUrlInfo(m_bb.m_uploadPartUrls);
+   // buffered parts are read and hashed once, retries are sent from memory
+   const string sha1 = m_bb.bufferedUploads() ? readPart(*buffer) : "";
    int attempt = 0;
    do {
       try {
-         ifstream fin(m_filepath.c_str(), ios::binary);
-         if(!fin.is_open()) {
-            throw std::runtime_error("could not read file " + m_filepath);
+         if (uploadUrlInfo->bucketOrFileId != m_fileId) {
+            *uploadUrlInfo = m_bb.getUploadPartUrl(m_fileId);
          }
 
-         BB::UploadUrlInfo uploadUrlInfo = m_bb.getUploadPartUrl(m_fileId);
-
-         m_hash = m_bb.uploadPart(uploadUrlInfo.uploadUrl, uploadUrlInfo.authorizationToken, m_index + 1, m_range, fin);
+         if (sha1.empty()) {
+            FileSource source(m_filepath, m_range.start, m_range.length(), &m_bytesRead);
+            Sha1Source body(source);
+            m_bb.uploadPart(uploadUrlInfo->uploadUrl, uploadUrlInfo->authorizationToken, m_index + 1, body, m_range.length() + Sha1Source::TRAILER_LENGTH, "hex_digits_at_end");
+            m_hash = body.hash();
+         } else {
+            MemorySource body(&(*buffer)[0], buffer->size());
+            m_bb.uploadPart(uploadUrlInfo->uploadUrl, uploadUrlInfo->authorizationToken, m_index + 1, body, buffer->size(), sha1);
+            m_hash = sha1;
+         }
       } catch (const ResponseError& err) {
-         if (500 /* HTTP internal server error */ <= err.m_status && err.m_status <= 599 /* HTTP network connect timeout */ && attempt < m_bb.uploadRetryAttempts()) {
+         if (BB::expiredUploadUrl(err.m_status)) {
+            // fetched again on the next attempt, whoever leases it after us included
+            *uploadUrlInfo = BB::UploadUrlInfo();
+         }
+         if (BB::expiredUploadUrl(err.m_status) && attempt < m_bb.uploadRetryAttempts()) {
             cerr << "err.m_status = " << err.m_status << " attempt: " <<  attempt << endl;
             /* sleep for 5 seconds multiplied by number of the attempt before resuming */
             sleep((attempt + 1) * 5);
@@ -137,39 +247,56 @@ int UploadPartTask::run() {
          }
       }
    } while (m_hash.empty());
+   m_journal.record(m_index, m_hash);
    return EXIT_SUCCESS;
 }
 
-vector<string> UploadPartTask::map(const vector<UploadPartTask*>& uploads) {
-   vector<string> hashes;
-   std::transform(uploads.begin(), uploads.end(), back_inserter(hashes), result);
-   return hashes;
+string UploadPartTask::readPart(vector<char>& buffer) {
+   // resize keeps the capacity of earlier, larger parts so the buffer is
+   // only ever grown, never reallocated per part
+   buffer.resize(m_range.length());
+   FileSource source(m_filepath, m_range.start, m_range.length(), &m_bytesRead);
+   size_t filled = 0;
+   while (filled < buffer.size()) {
+      filled += source.read(&buffer[filled], buffer.size() - filled);
+   }
+   Sha1Digest digest;
+   digest.update(&buffer[0], buffer.size());
+   return digest.hex();
 }
 
-string UploadPartTask::result(const UploadPartTask* task) {
-   return task->hash();
+uint64_t UploadPartTask::totalBytesRead(const vector<UploadPartTask*>& uploads) {
+   uint64_t total = 0;
+   for (vector<UploadPartTask*>::const_iterator iter = uploads.begin(); iter != uploads.end(); ++iter) {
+      total += (*iter)->bytesRead();
+   }
+   return total;
 }
 
-DownloadPartTask::DownloadPartTask(const BB& bb, const string& authorizationToken, const string& downloadUrl, const BB_Range& range, int index, const string& filepath)
+DownloadPartTask::DownloadPartTask(const BB& bb, const string& authorizationToken, const string& downloadUrl, const BB_Range& range, int index, int fd, uint64_t done, Journal& journal, OrderedDigest* digest)
    :  Task(NULL, "download_part_task"),
       m_bb(bb),
-      m_downloadUrl(downloadUrl),
       m_authorizationToken(authorizationToken),
+      m_downloadUrl(downloadUrl),
       m_range(range),
       m_index(index),
-      m_filepath(filepath),
-      m_result("failed") {
+      m_fd(fd),
+      m_done(done),
+      m_journal(journal),
+      m_digest(digest) {
 }
 
 DownloadPartTask::DownloadPartTask(const DownloadPartTask& other)
    :  Task(NULL, "download_part_task"),
       m_bb(other.m_bb),
-      m_downloadUrl(other.m_downloadUrl),
       m_authorizationToken(other.m_authorizationToken),
+      m_downloadUrl(other.m_downloadUrl),
       m_range(other.m_range),
       m_index(other.m_index),
-      m_filepath(other.m_filepath),
-      m_result(other.m_result) {
+      m_fd(other.m_fd),
+      m_done(other.m_done),
+      m_journal(other.m_journal),
+      m_digest(other.m_digest) {
 }
 
 DownloadPartTask::~DownloadPartTask() {
@@ -177,87 +304,145 @@ DownloadPartTask::~DownloadPartTask() {
 
 int DownloadPartTask::run() {
    int attempt = 0;
-   do {
+   while (m_done < m_range.length()) {
+      // a retry, or a resumed run, asks only for what is still missing
+      FileSink sink(m_fd, m_range.start + m_done);
+      std::unique_ptr<DigestSink> hashed(m_digest ? new DigestSink(sink, *m_digest, m_range.start + m_done) : NULL);
       try {
-         struct stat st;
-         const string downloadPath = DownloadPartTask::downloadPath(m_filepath);
-         if (stat(downloadPath.c_str(), &st)) {
-            if (mkdir(downloadPath.c_str(), 0755) && errno != EEXIST) {
-               throw std::runtime_error("could not create download directory, possible race condition");
-            }
-         } else if(!S_ISDIR(st.st_mode)) {
-            throw std::runtime_error("could not create download directory, file with matching name exists");
-         }
-         const string filepart = DownloadPartTask::filepart(downloadPath, m_index);
-         ofstream fs(filepart.c_str(), ios_base::binary | ios_base::out);
-         m_result = m_bb.downloadPart(m_downloadUrl, m_authorizationToken, m_index, m_range, fs);
+         m_bb.downloadPart(m_downloadUrl, m_authorizationToken, BB_Range(m_range.start + m_done, m_range.end), hashed ? static_cast<Sink&>(*hashed) : sink);
+         m_done += sink.written();
       } catch(const ResponseError& err) {
-         if (500 /* HTTP internal server error */ <= err.m_status && err.m_status <= 599 /* HTTP network connect timeout */ && attempt < m_bb.uploadRetryAttempts()) {
+         m_done += sink.written();
+         record();
+         if (BB::transientFailure(err.m_status) && attempt < m_bb.uploadRetryAttempts()) {
             attempt++;
          } else {
             cerr << err.what() << endl;
             throw;
          }
       }
-   } while (m_result == "failed" /* try again until we throw in catch block */);
+   }
+   record();
    return EXIT_SUCCESS;
 }
 
-const string DownloadPartTask::filepart(const string& path, int index) {
-   ostringstream convertIndex;
-   convertIndex << "/";
-   convertIndex << "part";
-   convertIndex << index;
-   return path + convertIndex.str();
+void DownloadPartTask::record() {
+   ostringstream done;
+   done << m_done;
+   m_journal.record(m_index, done.str());
 }
 
-void DownloadPartTask::coalesce(const string& filepath, const vector<DownloadPartTask*>& downloads) {
-   ofstream out(filepath.c_str(), ios_base::binary | ios_base::out);
-   const string downloadPath = DownloadPartTask::downloadPath(filepath);
-   vector<DownloadPartTask*>::const_iterator iter = downloads.begin();
-   for (;iter != downloads.end(); ++iter) {
-      const string filepart = DownloadPartTask::filepart(downloadPath, (*iter)->m_index);
-      ifstream in(filepart.c_str(), ios_base::binary);
-      out << in.rdbuf();
-      in.close();
-   }
-   out.close();
-   DownloadPartTask::cleanup(filepath, downloads);
+StreamPartTask::StreamPartTask(const BB& bb, const string& authorizationToken, const string& downloadUrl, const vector<BB_Range>& ranges, ReorderRing& ring)
+   :  Task(NULL, "stream_part_task"),
+      m_bb(bb),
+      m_authorizationToken(authorizationToken),
+      m_downloadUrl(downloadUrl),
+      m_ranges(ranges),
+      m_ring(ring) {
+}
+
+StreamPartTask::StreamPartTask(const StreamPartTask& other)
+   :  Task(NULL, "stream_part_task"),
+      m_bb(other.m_bb),
+      m_authorizationToken(other.m_authorizationToken),
+      m_downloadUrl(other.m_downloadUrl),
+      m_ranges(other.m_ranges),
+      m_ring(other.m_ring) {
 }
 
-void DownloadPartTask::cleanup(const string& filepath, const vector<DownloadPartTask*>& downloads) {
-   const string downloadPath = DownloadPartTask::downloadPath(filepath);
-   for (vector<DownloadPartTask*>::const_iterator iter = downloads.begin(); iter != downloads.end(); ++iter) {
-      const string filepart = DownloadPartTask::filepart(downloadPath, (*iter)->m_index);
-      if (remove(filepart.c_str())) {
-         cerr << "error cleaning up temporary file " << filepart << endl;
+StreamPartTask::~StreamPartTask() {
+}
+
+int StreamPartTask::run() {
+   // one task per thread, each fetching whichever range is next in line
+   size_t index;
+   vector<char> buffer;
+   while (m_ring.claim(index)) {
+      try {
+         fetch(m_ranges[index], buffer);
+      } catch(...) {
+         m_ring.fail();
+         throw;
       }
+      m_ring.commit(index, buffer);
    }
-   if (rmdir(downloadPath.c_str())) {
-      cerr << "error removing temporary download directory " << downloadPath << endl;
+   return EXIT_SUCCESS;
+}
+
+void StreamPartTask::fetch(const BB_Range& range, vector<char>& buffer) {
+   buffer.clear();
+   buffer.reserve(range.length());
+   int attempt = 0;
+   while (buffer.size() < range.length()) {
+      BufferSink sink(buffer);
+      try {
+         m_bb.downloadPart(m_downloadUrl, m_authorizationToken, BB_Range(range.start + buffer.size(), range.end), sink);
+      } catch(const ResponseError& err) {
+         if (BB::transientFailure(err.m_status) && attempt < m_bb.uploadRetryAttempts() && !m_ring.failed()) {
+            attempt++;
+         } else {
+            cerr << err.what() << endl;
+            throw;
+         }
+      }
    }
 }
 
-const string DownloadPartTask::downloadPath(const string& filepath) {
-   return filepath + ".download";
+ListBucketTask::ListBucketTask(BB& bb, BB_Bucket& bucket)
+   :  Task(NULL, "list_bucket_task"),
+      m_bb(bb),
+      m_bucket(bucket) {
+}
+
+int ListBucketTask::run() {
+   // by id, getBucket() must not be called from a worker while the bucket
+   // list itself is being filled in
+   ObjectList objects;
+   try {
+      FileNameListing listing(m_bb, m_bucket.id);
+      BB_Object object;
+      while (listing.next(object)) {
+         objects.push_back(object);
+      }
+   } catch(const ResponseError& err) {
+      cerr << m_bucket.name << ": " << err.what() << endl;
+      return EXIT_FAILURE;
+   } catch(const std::exception& e) {
+      cerr << m_bucket.name << ": " << e.what() << endl;
+      return EXIT_FAILURE;
+   }
+
+   pthread_mutex_lock(&m_bb.m_bucketsMutex);
+   m_bucket.objects.swap(objects);
+   pthread_mutex_unlock(&m_bb.m_bucketsMutex);
+   return EXIT_SUCCESS;
 }
 
 BB::BB(const string& accountId, const string& applicationKey, bool testMode) :
    m_accountId(accountId),
    m_applicationKey(applicationKey),
    m_session(Session::load()),
-   m_testMode(testMode)
+   m_testMode(testMode),
+   m_verbosity(1),
+   m_bufferedUploads(false),
+   m_splitThreshold(0),
+   m_bucketThreads(DEFAULT_BUCKET_THREADS)
 {
+   pthread_mutex_init(&m_bucketsMutex, NULL);
    RestClient::init();
 }
 
 BB::~BB() {
+   // pooled handles have to be released before curl is shut down
+   m_connections.clear();
+   m_transfers.clear();
    RestClient::disable();
+   pthread_mutex_destroy(&m_bucketsMutex);
 }
 
 void BB::authorize() {
    if (m_session.unknown()) {
-      unique_ptr<RestClient::Connection> connection = connect("https://api.backblaze.com" + API_URL_PATH);
+      PooledConnection connection = connect("https://api.backblaze.com" + API_URL_PATH);
       connection->SetBasicAuth(m_accountId, m_applicationKey);
 
       RestClient::HeaderFields headers;
@@ -274,15 +459,31 @@ void BB::authorize() {
       m_session.apiUrl = apiUrl.get<std::string>();
       m_session.downloadUrl = downloadUrl.get<std::string>();
       m_session.authorizationToken = authorizationToken.get<std::string>();
+
+      Json recommendedPartSize = json.get("recommendedPartSize");
+      if (recommendedPartSize.isInteger())
+         m_session.recommendedPartSize = recommendedPartSize.get<uint64_t>();
+
+      Json absoluteMinimumPartSize = json.get("absoluteMinimumPartSize");
+      if (absoluteMinimumPartSize.isInteger())
+         m_session.absoluteMinimumPartSize = absoluteMinimumPartSize.get<uint64_t>();
+
       m_session.save();
    }
 }
 
-unique_ptr<RestClient::Connection> BB::connect(const string& baseUrl) const {
-   RestClient::Connection* connection = new RestClient::Connection(baseUrl);
+BB::PooledConnection BB::connect(const string& baseUrl) const {
+   // pooled connections keep their socket and TLS session alive between
+   // calls, only the headers of the previous request have to go
+   PooledConnection connection = m_connections.lease(baseUrl);
    connection->SetUserAgent("cmd/blazer");
    connection->SetNoSignal(true);
-   return unique_ptr<RestClient::Connection>(connection);
+   connection->SetHeaders(RestClient::HeaderFields());
+   return connection;
+}
+
+BB::PooledTransfer BB::stream(const string& baseUrl) const {
+   return m_transfers.lease(baseUrl);
 }
 
 list<BB_Bucket> BB::unpackBucketsList(const string& json) {
@@ -305,20 +506,18 @@ list<BB_Bucket> BB::unpackBucketsList(const string& json) {
    return buckets;
 }
 
-list<BB_Object> BB::unpackObjectsList(const string& json) {
-   list<BB_Object> files;
-   Json root = Json::load(json); 
-   if (root.isObject()) { 
-      Json array = root.get("files");
-      if (array.isArray()) { 
-         for (int i = 0; i < array.size(); ++i) { 
-           Json elem = array.at(i);
-            if (elem.isObject()) { 
-               files.push_back(unpackObject(elem));
-            }
-         }
-      }
-      Json nextFileName = root.get("nextFileName");
+ObjectList BB::unpackObjectsList(const string& json, string* nextFileName, string* nextFileId) {
+   // read straight off the body, a page of thousands of files would
+   // otherwise be a document tree of tens of thousands of nodes first
+   ObjectList files;
+   ListCollector collector(files);
+   ListReader reader(json.data(), json.size());
+   reader.read(collector);
+   if (nextFileName) {
+      *nextFileName = reader.nextFileName();
+   }
+   if (nextFileId) {
+      *nextFileId = reader.nextFileId();
    }
    return files;
 }
@@ -341,6 +540,10 @@ BB_Object BB::unpackObject(const Json& json) {
    if (contentSha1.isString())
       object.contentSha1 = contentSha1.get<string>();
 
+   Json fileInfo = json.get("fileInfo");
+   if (fileInfo.isObject() && fileInfo.get("large_file_sha1").isString())
+      object.largeFileSha1 = fileInfo.get("large_file_sha1").get<string>();
+
    Json fileId = json.get("fileId"); 
    if (fileId.isString())
       object.id = fileId.get<string>();
@@ -363,8 +566,14 @@ std::list<BB_Bucket>& BB::getBuckets(bool getContents, bool refresh) {
 }
 
 BB_Bucket BB::getBucket(const string& bucketName) {
+   bool cached = m_buckets.empty() && loadBucketCache();
    const std::list<BB_Bucket>& buckets = getBuckets(false, false);
    list<BB_Bucket>::const_iterator it = std::find_if(buckets.begin(), buckets.end(), find_name(bucketName)); 
+   if (it == buckets.end() && cached) {
+      // the bucket may be newer than the cache, only a miss goes to the api
+      refreshBuckets(false);
+      it = std::find_if(buckets.begin(), buckets.end(), find_name(bucketName)); 
+   }
    if (it == buckets.end()) { 
       throw std::runtime_error("non existent bucket");
    }
@@ -373,23 +582,83 @@ BB_Bucket BB::getBucket(const string& bucketName) {
 
 void BB::refreshBuckets(bool getContents) {
    m_buckets = listBuckets();
-   if (getContents) {
+   saveBucketCache();
+   if (getContents && !m_buckets.empty()) {
+      // each bucket is listed on its own worker, so the whole inventory
+      // takes about as long as the largest bucket rather than the sum
+      vector<ListBucketTask*> listings;
+      Dispatcho dispatcho(static_cast<int>(std::min(static_cast<size_t>(std::max(1, m_bucketThreads)), m_buckets.size())));
       for (list<BB_Bucket>::iterator bkt = m_buckets.begin(); bkt != m_buckets.end(); ++bkt) { 
-         (*bkt).objects = listBucket((*bkt).name);
+         listings.push_back(new ListBucketTask(*this, *bkt));
+         dispatcho.async(listings.back());
+      }
+      int rc = dispatcho.workoff();
+      for (vector<ListBucketTask*>::iterator iter = listings.begin(); iter != listings.end(); ++iter) {
+         delete (*iter);
+      }
+      if (rc != EXIT_SUCCESS) {
+         throw std::runtime_error("could not list the contents of every bucket");
       }
    }
 }
 
+void BB::setBucketThreads(int numThreads) {
+   m_bucketThreads = numThreads;
+}
+
+bool BB::loadBucketCache() {
+   ifstream strm(bucketCachePath().c_str());
+   time_t timestamp;
+   string accountId;
+   if (!(strm >> timestamp >> accountId) || accountId != m_accountId || time(NULL) - timestamp >= BUCKET_CACHE_TTL_SECONDS) {
+      return false;
+   }
+   list<BB_Bucket> buckets;
+   string id;
+   string name;
+   string type;
+   while (strm >> id >> name >> type) {
+      buckets.push_back(BB_Bucket(id, name, type));
+   }
+   m_buckets.swap(buckets);
+   return !m_buckets.empty();
+}
+
+void BB::saveBucketCache() const {
+   // written aside and renamed so a concurrent reader never sees half a list
+   ostringstream tmp;
+   tmp << bucketCachePath() << ".tmp." << getpid();
+   Session::createDirectory();
+   ofstream strm(tmp.str().c_str());
+   if (!strm) {
+      return;
+   }
+   strm << time(NULL) << " " << m_accountId << endl;
+   for (list<BB_Bucket>::const_iterator bkt = m_buckets.begin(); bkt != m_buckets.end(); ++bkt) {
+      strm << bkt->id << " " << bkt->name << " " << bkt->type << endl;
+   }
+   strm.close();
+   if (!strm || rename(tmp.str().c_str(), bucketCachePath().c_str())) {
+      remove(tmp.str().c_str());
+   }
+}
+
+void BB::invalidateBucketCache() {
+   m_buckets.clear();
+   remove(bucketCachePath().c_str());
+}
+
 const BB::UploadUrlInfo BB::getUploadUrl(const string& bucketId) const {
-   unique_ptr<RestClient::Connection> connection = connect(m_session.apiUrl + API_URL_PATH);
+   PooledConnection connection = connect(m_session.apiUrl + API_URL_PATH);
 
    RestClient::HeaderFields headers;
    headers["Authorization"] = m_session.authorizationToken;
    connection->SetHeaders(headers);
 
-   Json payload = Json::object();
-   payload.set("bucketId", Json::string(bucketId));
-   RestClient::Response response = validate(connection->post("/b2_get_upload_url", payload.dump()));
+   Pool<std::string>::Lease body(m_requestBodies);
+   JsonWriter request(*body);
+   request.begin().field("bucketId", bucketId).end();
+   RestClient::Response response = validate(connection->post("/b2_get_upload_url", request.str()));
 
    Json json = Json::load(response.body);
 
@@ -401,15 +670,16 @@ const BB::UploadUrlInfo BB::getUploadUrl(const string& bucketId) const {
 }
 
 const BB::UploadUrlInfo BB::getUploadPartUrl(const string& fileId) const {
-   unique_ptr<RestClient::Connection> connection = connect(m_session.apiUrl + API_URL_PATH);
+   PooledConnection connection = connect(m_session.apiUrl + API_URL_PATH);
 
    RestClient::HeaderFields headers;
    headers["Authorization"] = m_session.authorizationToken;
    connection->SetHeaders(headers);
 
-   Json payload = Json::object();
-   payload.set("fileId", Json::string(fileId));
-   RestClient::Response response = validate(connection->post("/b2_get_upload_part_url", payload.dump()));
+   Pool<std::string>::Lease body(m_requestBodies);
+   JsonWriter request(*body);
+   request.begin().field("fileId", fileId).end();
+   RestClient::Response response = validate(connection->post("/b2_get_upload_part_url", request.str()));
 
    Json json = Json::load(response.body);
 
@@ -420,6 +690,20 @@ const BB::UploadUrlInfo BB::getUploadPartUrl(const string& fileId) const {
    return info;
 }
 
+bool BB::expiredUploadUrl(int status) {
+   return status < 100 /* connection failed or timed out */
+      || status == 401 /* upload url authorization token expired */
+      || status == 408 /* HTTP request timeout */
+      || (500 /* HTTP internal server error */ <= status && status <= 599 /* HTTP network connect timeout */);
+}
+
+bool BB::transientFailure(int status) {
+   return status < 100 /* connection failed or timed out */
+      || status == 408 /* HTTP request timeout */
+      || status == 429 /* HTTP too many requests */
+      || (500 /* HTTP internal server error */ <= status && status <= 599 /* HTTP network connect timeout */);
+}
+
 int BB::uploadRetryAttempts() const {
    return DEFAULT_UPLOAD_RETRY_ATTEMPTS;
 }
@@ -428,6 +712,63 @@ bool BB::useTestMode() {
    return (m_testMode);
 }
 
+void BB::setVerbosity(int verbosity) {
+   m_verbosity = verbosity;
+}
+
+void BB::setBufferedUploads(bool buffered) {
+   m_bufferedUploads = buffered;
+}
+
+bool BB::bufferedUploads() const {
+   return m_bufferedUploads;
+}
+
+void BB::setSplitThreshold(uint64_t bytes) {
+   m_splitThreshold = bytes;
+}
+
+uint64_t BB::splitThreshold(int numThreads) const {
+   // B2 will not finish a large file of fewer than two parts
+   const uint64_t twoParts = 2 * absoluteMinimumPartSize();
+   if (m_splitThreshold > 0) {
+      return std::max(m_splitThreshold, twoParts);
+   }
+   // one stream gains nothing from parts but retry granularity
+   if (numThreads <= 1) {
+      return MINIMUM_SPLIT_SIZE_BYTES;
+   }
+
+   // every thread should at least get a minimum sized part of its own
+   const uint64_t floor = std::max(twoParts, static_cast<uint64_t>(numThreads) * absoluteMinimumPartSize());
+   uint64_t threshold;
+   if (m_uploadStats.measured()) {
+      // parts save the file (1 - 1/n) of its single stream time, and cost
+      // b2_start_large_file and b2_finish_large_file on top of the upload
+      // url every stream fetches; split once the saving is a clear margin
+      // above that cost
+      const double saving = (1.0 - 1.0 / numThreads) / m_uploadStats.streamBytesPerSecond();
+      const double cost = SPLIT_BENEFIT_MARGIN * SPLIT_EXTRA_CALLS * m_uploadStats.callSeconds();
+      threshold = static_cast<uint64_t>(std::min(cost / saving, static_cast<double>(MINIMUM_SPLIT_SIZE_BYTES)));
+   } else {
+      // nothing measured yet, give every thread a few minimum sized parts
+      threshold = static_cast<uint64_t>(numThreads) * SPLIT_PARTS_PER_THREAD * absoluteMinimumPartSize();
+   }
+   threshold = std::max(std::min(threshold, static_cast<uint64_t>(MINIMUM_SPLIT_SIZE_BYTES)), floor);
+
+   if (m_verbosity > 1) {
+      cerr << "split threshold " << threshold << " bytes for " << numThreads << " threads";
+      if (m_uploadStats.measured()) {
+         cerr << " (measured " << static_cast<uint64_t>(m_uploadStats.streamBytesPerSecond()) << " bytes/s per stream, "
+              << std::fixed << std::setprecision(3) << m_uploadStats.callSeconds() << " s per call)";
+      } else {
+         cerr << " (nothing measured yet)";
+      }
+      cerr << endl;
+   }
+   return threshold;
+}
+
 int BB::uploadFile(const string& bucketName, const string& localFilePath, const string& remoteFileName, const string& contentType, int numThreads) {
 
    BB_Bucket bucket = getBucket(bucketName);
@@ -435,39 +776,141 @@ int BB::uploadFile(const string& bucketName, const string& localFilePath, const
    ifstream fsz(localFilePath.c_str(), ios::binary | ios::ate);
    uint64_t totalBytes = fsz.tellg();
 
-   if (totalBytes < MINIMUM_SPLIT_SIZE_BYTES) {
-      return uploadSmall(bucket.id, localFilePath, remoteFileName, contentType, totalBytes);
+   m_uploadStats.load();
+   int rc;
+   if (totalBytes < splitThreshold(numThreads)) {
+      rc = uploadSmall(bucket.id, localFilePath, remoteFileName, contentType, totalBytes);
    } else {
-      return uploadLarge(bucket.id, localFilePath, remoteFileName, contentType, totalBytes, numThreads);
+      rc = uploadLarge(bucket.id, localFilePath, remoteFileName, contentType, totalBytes, numThreads);
    }
+   m_uploadStats.save();
+   return rc;
 }
 
 int BB::downloadFileById(const string& id, const string& localFilePath, int numThreads) {
-   unique_ptr<RestClient::Connection> connection = connect(m_session.downloadUrl + API_URL_PATH);
-
    BB_Object fileInfo = getFileInfo(id);
    if (fileInfo.id != id) {
       throw std::runtime_error("retrieved fileid does not match passed fileid");
    }
 
-   vector<BB_Range> ranges = choosePartRanges(fileInfo.contentLength);
-   Dispatcho dispatcho(std::min(static_cast<size_t>(numThreads), ranges.size()));
-
    const string downloadUrl = m_session.downloadUrl + API_URL_PATH + "/b2_download_file_by_id?fileId=" + id;
+   return downloadRanges(downloadUrl, fileInfo, localFilePath, numThreads);
+}
+
+int BB::downloadFileByName(const string& bucketName, const string& remoteFileName, const string& localFilePath, int numThreads) {
+   const string path = "/" + bucketName + "/" + remoteFileName;
+
+   // a HEAD request sizes the object so it can be fetched as parallel ranges
+   PooledConnection connection = connect(m_session.downloadUrl + "/file");
+
+   RestClient::HeaderFields headers; 
+   headers["Authorization"] = m_session.authorizationToken;
+   connection->SetHeaders(headers);
+
+   RestClient::Response response = validate(connection->head(path));
+
+   BB_Object object;
+   object.name = remoteFileName;
+   object.id = headerValue(response.headers, "X-Bz-File-Id");
+   object.contentSha1 = headerValue(response.headers, "X-Bz-Content-Sha1");
+   object.largeFileSha1 = headerValue(response.headers, "X-Bz-Info-large_file_sha1");
+   std::istringstream contentLength(headerValue(response.headers, "Content-Length"));
+   if (!(contentLength >> object.contentLength)) {
+      throw std::runtime_error("could not determine the size of " + remoteFileName);
+   }
+   if (object.id.empty()) {
+      throw std::runtime_error("could not determine the file id of " + remoteFileName);
+   }
+
+   // ranges are fetched by id so a version uploaded mid download cannot
+   // get mixed into this one
+   const string downloadUrl = m_session.downloadUrl + API_URL_PATH + "/b2_download_file_by_id?fileId=" + object.id;
+   return downloadRanges(downloadUrl, object, localFilePath, numThreads);
+}
+
+int BB::downloadRanges(const string& downloadUrl, const BB_Object& object, const string& localFilePath, int numThreads) {
+   if (localFilePath == "-") {
+      return streamRanges(downloadUrl, object, numThreads);
+   }
+
+   const uint64_t totalBytes = object.contentLength;
+
+   Journal journal("download " + object.id + " " + object.contentSha1 + " " + absolute(localFilePath));
+
+   ostringstream stamp;
+   stamp << totalBytes;
+
+   // a journal is only worth resuming while the file it describes is intact
+   int fd = journal.load(stamp.str()) ? reopen(localFilePath, totalBytes) : -1;
+   if (fd < 0) {
+      fd = preallocate(localFilePath, totalBytes);
+      journal.begin(object.id.empty() ? "-" : object.id, stamp.str(), totalBytes > 0 ? chooseDownloadRanges(totalBytes, numThreads > 0 ? numThreads : DEFAULT_DOWNLOAD_THREADS) : vector<BB_Range>());
+   }
+   const vector<BB_Range>& ranges = journal.ranges();
+   const map<int, string>& recorded = journal.entries();
+
+   // hashed while it is written, rather than by reading the file back after
+   const string sha1 = expectedSha1(object);
+   OrderedDigest digest(totalBytes, DOWNLOAD_DIGEST_WINDOW_BYTES);
 
    int index = 0;
+   uint64_t present = 0;
    vector<DownloadPartTask*> downloads;
-   for (vector<BB_Range>::const_iterator iter = ranges.begin(); iter != ranges.end(); ++iter) {
-      downloads.push_back(new DownloadPartTask(*this, m_session.authorizationToken, downloadUrl, *iter, index++, localFilePath));
-      dispatcho.async(downloads.back());
+   for (vector<BB_Range>::const_iterator iter = ranges.begin(); iter != ranges.end(); ++iter, ++index) {
+      uint64_t done = 0;
+      map<int, string>::const_iterator entry = recorded.find(index);
+      if (entry != recorded.end()) {
+         done = std::min(static_cast<uint64_t>(strtoull(entry->second.c_str(), NULL, 10)), iter->length());
+      }
+      present += done;
+      if (done < iter->length()) {
+         downloads.push_back(new DownloadPartTask(*this, m_session.authorizationToken, downloadUrl, *iter, index, fd, done, journal, sha1.empty() ? NULL : &digest));
+      }
    }
+   const size_t threads = std::min(static_cast<size_t>(numThreads > 0 ? numThreads : DEFAULT_DOWNLOAD_THREADS), downloads.size());
 
-   int rc = dispatcho.stop();
+   if (m_verbosity > 0 && present > 0) {
+      cerr << "resuming download, " << present << " of " << totalBytes << " bytes already present" << endl;
+   }
+   if (m_verbosity > 1) {
+      cerr << "downloading " << totalBytes << " bytes as " << ranges.size() << " ranges of "
+           << (ranges.empty() ? 0 : ranges.front().length()) << " bytes on " << threads << " threads" << endl;
+   }
 
-   if (rc == EXIT_SUCCESS) {
-      DownloadPartTask::coalesce(localFilePath, downloads);
-   } else if (rc == EXIT_FAILURE) {
-      DownloadPartTask::cleanup(localFilePath, downloads);
+   int rc = EXIT_SUCCESS;
+   if (!downloads.empty()) {
+      Dispatcho dispatcho(threads);
+      for (vector<DownloadPartTask*>::iterator iter = downloads.begin(); iter != downloads.end(); ++iter) {
+         dispatcho.async(*iter);
+      }
+      rc = dispatcho.workoff();
+   }
+
+   bool corrupt = false;
+   if (rc == EXIT_SUCCESS && !sha1.empty()) {
+      const string actual = digest.finish(fd);
+      if (m_verbosity > 1) {
+         cerr << "hashed " << digest.hashedInline() << " of " << totalBytes << " bytes as they were written" << endl;
+      }
+      if (actual != sha1) {
+         cerr << "sha1 mismatch for " << localFilePath << ", expected " << sha1 << " got " << actual << endl;
+         corrupt = true;
+         rc = EXIT_FAILURE;
+      }
+   }
+
+   if (close(fd) && rc == EXIT_SUCCESS) {
+      cerr << "error closing " << localFilePath << endl;
+      rc = EXIT_FAILURE;
+   }
+   if (corrupt) {
+      // nothing written so far can be trusted, the next attempt starts over
+      journal.remove();
+      unlink(localFilePath.c_str());
+   } else if (rc == EXIT_SUCCESS) {
+      journal.remove();
+   } else {
+      cerr << "download of " << localFilePath << " is incomplete, download it again to resume" << endl;
    }
 
    for (vector<DownloadPartTask*>::iterator iter = downloads.begin(); iter != downloads.end(); ++iter) {
@@ -477,23 +920,90 @@ int BB::downloadFileById(const string& id, const string& localFilePath, int numT
    return rc;
 }
 
-int BB::downloadFileByName(const string& bucketName, const string& remoteFileName, ofstream& fout, int numThreads) {
-   unique_ptr<RestClient::Connection> connection = connect(m_session.downloadUrl + "/file");
+int BB::streamRanges(const string& downloadUrl, const BB_Object& object, int numThreads) {
+   const uint64_t totalBytes = object.contentLength;
 
-   RestClient::HeaderFields headers; 
-   headers["Authorization"] = m_session.authorizationToken;
-   connection->SetHeaders(headers);
+   // ranges are held in memory until stdout takes them, so they are kept
+   // small and there are only ever a couple per thread in flight
+   const vector<BB_Range> ranges = totalBytes > 0 ? splitRanges(totalBytes, (totalBytes + STREAM_RANGE_BYTES - 1) / STREAM_RANGE_BYTES) : vector<BB_Range>();
+   const size_t threads = std::min(static_cast<size_t>(numThreads > 0 ? numThreads : DEFAULT_DOWNLOAD_THREADS), ranges.size());
+   ReorderRing ring(ranges.size(), 2 * threads);
 
-   RestClient::Response response = validate(connection->get("/" + bucketName+ "/" + remoteFileName));
+   if (m_verbosity > 1) {
+      cerr << "streaming " << totalBytes << " bytes as " << ranges.size() << " ranges of "
+           << (ranges.empty() ? 0 : ranges.front().length()) << " bytes on " << threads << " threads" << endl;
+   }
 
-   fout << response.body;
-   fout.close();
+   vector<StreamPartTask*> streams;
+   Dispatcho* dispatcho = threads > 0 ? new Dispatcho(threads) : NULL;
+   for (size_t i = 0; i < threads; ++i) {
+      streams.push_back(new StreamPartTask(*this, m_session.authorizationToken, downloadUrl, ranges, ring));
+      dispatcho->async(streams.back());
+   }
 
-   return EXIT_SUCCESS;
+   // this thread is the consumer, hashing and writing ranges in order
+   // while the workers fetch ahead of it
+   const string sha1 = expectedSha1(object);
+   Sha1Digest digest;
+   StreamSink out(cout);
+   int rc = EXIT_SUCCESS;
+   vector<char> buffer;
+   try {
+      while (ring.take(buffer)) {
+         if (!buffer.empty()) {
+            digest.update(&buffer[0], buffer.size());
+            out.write(&buffer[0], buffer.size());
+         }
+      }
+      cout.flush();
+   } catch(const std::exception& e) {
+      cerr << e.what() << endl;
+      rc = EXIT_FAILURE;
+   }
+   if (rc != EXIT_SUCCESS || ring.failed()) {
+      ring.fail();
+      rc = EXIT_FAILURE;
+   }
+
+   if (dispatcho) {
+      if (dispatcho->workoff() != EXIT_SUCCESS) {
+         rc = EXIT_FAILURE;
+      }
+      delete dispatcho;
+   }
+   for (vector<StreamPartTask*>::iterator iter = streams.begin(); iter != streams.end(); ++iter) {
+      delete (*iter);
+   }
+
+   if (rc == EXIT_SUCCESS && !sha1.empty()) {
+      const string actual = digest.hex();
+      if (actual != sha1) {
+         // the bytes are already downstream, failing is all that is left
+         cerr << "sha1 mismatch, expected " << sha1 << " got " << actual << endl;
+         rc = EXIT_FAILURE;
+      }
+   }
+
+   return rc;
+}
+
+string BB::expectedSha1(const BB_Object& object) {
+   // large files carry no content sha1 of their own, only what the uploader
+   // chose to record in their file info
+   string sha1 = object.contentSha1;
+   if (sha1.empty() || sha1 == "none") {
+      sha1 = object.largeFileSha1;
+   }
+   // sha1s sent at the end of an upload body come back marked unverified
+   const string unverified = "unverified:";
+   if (sha1.compare(0, unverified.size(), unverified) == 0) {
+      sha1.erase(0, unverified.size());
+   }
+   return sha1.size() == 40 ? sha1 : "";
 }
 
 void BB::createBucket(const string& bucketName) { 
-   unique_ptr<RestClient::Connection> connection = connect(m_session.apiUrl + API_URL_PATH);
+   PooledConnection connection = connect(m_session.apiUrl + API_URL_PATH);
 
    RestClient::HeaderFields headers; 
    headers["Authorization"] = m_session.authorizationToken;
@@ -502,83 +1012,96 @@ void BB::createBucket(const string& bucketName) {
    validate( 
       connection->get("/b2_create_bucket?accountId=" + m_accountId + "&bucketName=" + bucketName + "&bucketType=allPrivate")
    );
+   invalidateBucketCache();
 }
 
 void BB::deleteBucket(const string& bucketId) {
-   unique_ptr<RestClient::Connection> connection = connect(m_session.apiUrl + API_URL_PATH);
+   PooledConnection connection = connect(m_session.apiUrl + API_URL_PATH);
 
    RestClient::HeaderFields headers; 
    headers["Authorization"] = m_session.authorizationToken;
    connection->SetHeaders(headers);
 
    validate(connection->get("/b2_delete_bucket?accountId=" + m_accountId + "&bucketId=" + bucketId));
+   invalidateBucketCache();
 }
 
 void BB::updateBucket(const string& bucketId, const string& bucketType) {
-   unique_ptr<RestClient::Connection> connection = connect(m_session.apiUrl + API_URL_PATH);
+   PooledConnection connection = connect(m_session.apiUrl + API_URL_PATH);
    
    RestClient::HeaderFields headers; 
    headers["Authorization"] = m_session.authorizationToken;
    headers["Content-Type"] = "application/json";
    connection->SetHeaders(headers);
 
-   Json json = Json::object();
-   json.set("accountId", Json::string(m_accountId));
-   json.set("bucketId", Json::string(bucketId));
-   json.set("bucketType", Json::string(bucketType));
+   Pool<std::string>::Lease body(m_requestBodies);
+   JsonWriter json(*body);
+   json.begin().field("accountId", m_accountId).field("bucketId", bucketId).field("bucketType", bucketType).end();
 
-   validate(connection->post("/b2_update_bucket", json.dump()));
+   validate(connection->post("/b2_update_bucket", json.str()));
+   invalidateBucketCache();
 }
 
-std::list<BB_Object> BB::listFileVersions(const string& bucketId, const string& startFileName, const string& startFileId, int maxFileCount) {
-   unique_ptr<RestClient::Connection> connection = connect(m_session.apiUrl + API_URL_PATH);
+ObjectList BB::listFileVersions(const string& bucketId, const string& startFileName, const string& startFileId, int maxFileCount, const string& prefix, const string& delimiter) {
+   PooledConnection connection = connect(m_session.apiUrl + API_URL_PATH);
 
    RestClient::HeaderFields headers;
    headers["Authorization"] = m_session.authorizationToken;
    headers["Content-Type"] = "application/json";
    connection->SetHeaders(headers);
 
-   Json json = Json::object();
-   json.set("bucketId", Json::string(bucketId));
+   Pool<std::string>::Lease body(m_requestBodies);
+   JsonWriter json(*body);
+   json.begin().field("bucketId", bucketId);
    if (!startFileName.empty()) {
-      json.set("startFileName", Json::string(startFileName));
+      json.field("startFileName", startFileName);
       if (!startFileId.empty()) {
-         json.set("startFileId", Json::string(startFileId));
+         json.field("startFileId", startFileId);
       }
    }
-   json.set("maxFileCount", Json::integer(maxFileCount));
+   if (maxFileCount > 0) {
+      json.field("maxFileCount", maxFileCount);
+   }
+   if (!prefix.empty()) {
+      json.field("prefix", prefix);
+   }
+   if (!delimiter.empty()) {
+      json.field("delimiter", delimiter);
+   }
+   json.end();
 
-   return unpackObjectsList(validate(connection->post("/b2_list_file_versions", json.dump())).body);
+   return unpackObjectsList(validate(connection->post("/b2_list_file_versions", json.str())).body);
 }
 
 void BB::deleteFileVersion(const string& fileName, const string& fileId) {
-   unique_ptr<RestClient::Connection> connection = connect(m_session.apiUrl + API_URL_PATH);
+   PooledConnection connection = connect(m_session.apiUrl + API_URL_PATH);
    
    RestClient::HeaderFields headers;
    headers["Authorization"] = m_session.authorizationToken;
    connection->SetHeaders(headers);
 
-   Json json = Json::object();
-   json.set("fileName", Json::string(fileName));
-   json.set("fileId", Json::string(fileId));
+   Pool<std::string>::Lease body(m_requestBodies);
+   JsonWriter json(*body);
+   json.begin().field("fileName", fileName).field("fileId", fileId).end();
    
-   validate(connection->post("/b2_delete_file_version", json.dump()));
+   validate(connection->post("/b2_delete_file_version", json.str()));
 }
 
 const BB_Object BB::getFileInfo(const string& fileId) { 
    BB_Object object;
 
-   unique_ptr<RestClient::Connection> connection = connect(m_session.apiUrl + API_URL_PATH);
+   PooledConnection connection = connect(m_session.apiUrl + API_URL_PATH);
    
    RestClient::HeaderFields headers;
    headers["Authorization"] = m_session.authorizationToken;
 
    connection->SetHeaders(headers);
 
-   Json json = Json::object();
-   json.set("fileId", Json::string(fileId));
+   Pool<std::string>::Lease body(m_requestBodies);
+   JsonWriter json(*body);
+   json.begin().field("fileId", fileId).end();
 
-   RestClient::Response response = validate(connection->post("/b2_get_file_info", json.dump()));
+   RestClient::Response response = validate(connection->post("/b2_get_file_info", json.str()));
    Json obj = Json::load(response.body);
    if (obj.isObject()) {
       object = unpackObject(obj);
@@ -587,13 +1110,17 @@ const BB_Object BB::getFileInfo(const string& fileId) {
 }
 
 void BB::hideFile(const string& bucketId, const string& fileName) {
-   unique_ptr<RestClient::Connection> connection = connect(m_session.apiUrl + API_URL_PATH);
+   PooledConnection connection = connect(m_session.apiUrl + API_URL_PATH);
+
+   RestClient::HeaderFields headers;
+   headers["Authorization"] = m_session.authorizationToken;
+   connection->SetHeaders(headers);
 
-   Json json = Json::object();
-   json.set("bucketId", Json::string(bucketId));
-   json.set("fileName", Json::string(fileName));
+   Pool<std::string>::Lease body(m_requestBodies);
+   JsonWriter json(*body);
+   json.begin().field("bucketId", bucketId).field("fileName", fileName).end();
 
-   validate(connection->post("/b2_hide_file", json.dump()));
+   validate(connection->post("/b2_hide_file", json.str()));
 }
 
 int BB::uploadSmall(const string& bucketId, const string& localFilePath, const string& remoteFileName, const string& contentType, uint64_t totalBytes) {
@@ -602,10 +1129,13 @@ int BB::uploadSmall(const string& bucketId, const string& localFilePath, const s
       throw std::runtime_error("could not read file " + localFilePath);
    }
 
+   double started = UploadStats::now();
    const UploadUrlInfo uploadUrlInfo = getUploadUrl(bucketId);
+   m_uploadStats.recordCall(UploadStats::now() - started);
 
    uint8_t sha1[EVP_MAX_MD_SIZE];
    size_t length = computeSha1(sha1, fin);
+   fin.close();
 
    ostringstream sha1hex;
    sha1hex.fill('0');
@@ -615,7 +1145,7 @@ int BB::uploadSmall(const string& bucketId, const string& localFilePath, const s
       sha1hex << std::setw(2) << (unsigned int)(*ptr);
    }
 
-   unique_ptr<RestClient::Connection> connection = connect(uploadUrlInfo.uploadUrl);
+   PooledTransfer transfer = stream(uploadUrlInfo.uploadUrl);
 
    RestClient::HeaderFields headers;
    headers["Authorization"] = uploadUrlInfo.authorizationToken;
@@ -625,50 +1155,78 @@ int BB::uploadSmall(const string& bucketId, const string& localFilePath, const s
    if (m_testMode) {
       headers["X-Bz-Test-Mode"] = "fail_some_uploads";
    }
-   connection->SetHeaders(headers);
+   transfer->setHeaders(headers);
 
-   fin.clear();
-   fin.seekg(0, ios_base::beg);
-
-   char* buf = new char[totalBytes];
-   fin.read(buf, totalBytes);
-   if (fin.fail()) {
-      throw std::runtime_error("could not read all of " + localFilePath);
-   }
-   fin.close();
-
-   RestClient::Response response = connection->post("", string(buf, totalBytes));
-   delete[] buf;
-   validate(response);
+   // the body is fed to the socket straight from the file so memory use
+   // does not grow with the size of the upload
+   FileSource source(localFilePath, 0, totalBytes);
+   started = UploadStats::now();
+   validate(transfer->post("", source, totalBytes));
+   m_uploadStats.recordStream(totalBytes, UploadStats::now() - started);
 
    return EXIT_SUCCESS;
 }
 
 int BB::uploadLarge(const string& bucketId, const string& localFilePath, const string& remoteFileName, const string& contentType, uint64_t totalBytes, int numThreads) {
-   ifstream fin(localFilePath.c_str(), ios::binary);
-   if(!fin.is_open()) {
+   struct stat st;
+   if (stat(localFilePath.c_str(), &st)) {
       throw std::runtime_error("could not read file " + localFilePath);
    }
 
-   string fileId = startLargeFile(bucketId, remoteFileName, contentType);
+   // a changed size or modification time means the parts of an earlier
+   // attempt no longer describe this file
+   ostringstream stamp;
+   stamp << totalBytes << ":" << st.st_mtime;
 
-   vector<BB_Range> ranges = choosePartRanges(totalBytes);
+   Journal journal("upload " + bucketId + " " + absolute(localFilePath) + " " + remoteFileName);
+   vector<string> hashes;
 
-   Dispatcho dispatcho(numThreads);
+   string fileId = resumeLargeFile(bucketId, remoteFileName, stamp.str(), journal, hashes);
+   if (fileId.empty()) {
+      const double started = UploadStats::now();
+      fileId = startLargeFile(bucketId, remoteFileName, contentType);
+      m_uploadStats.recordCall(UploadStats::now() - started);
+      journal.begin(fileId, stamp.str(), choosePartRanges(totalBytes, numThreads));
+      hashes.assign(journal.ranges().size(), "");
+   }
+   const vector<BB_Range>& ranges = journal.ranges();
 
-   int index = 0;
    vector<UploadPartTask*> uploads;
-   for (vector<BB_Range>::const_iterator iter = ranges.begin(); iter != ranges.end(); ++iter) {
-      uploads.push_back(new UploadPartTask(*this, fileId, *iter, index++, localFilePath));
-      dispatcho.async(uploads.back());
+   for (size_t index = 0; index < ranges.size(); ++index) {
+      if (hashes[index].empty()) {
+         uploads.push_back(new UploadPartTask(*this, fileId, ranges[index], index, localFilePath, journal));
+      }
    }
 
-   int rc = dispatcho.workoff();
+   int rc = EXIT_SUCCESS;
+   if (!uploads.empty()) {
+      Dispatcho dispatcho(numThreads);
+      for (vector<UploadPartTask*>::iterator iter = uploads.begin(); iter != uploads.end(); ++iter) {
+         dispatcho.async(*iter);
+      }
+      rc = dispatcho.workoff();
+   }
 
    if (rc == EXIT_SUCCESS) {
-      finishLargeFile(fileId, UploadPartTask::map(uploads));
+      for (vector<UploadPartTask*>::const_iterator iter = uploads.begin(); iter != uploads.end(); ++iter) {
+         hashes[(*iter)->index()] = (*iter)->hash();
+      }
+      const double started = UploadStats::now();
+      finishLargeFile(fileId, hashes);
+      m_uploadStats.recordCall(UploadStats::now() - started);
+      journal.remove();
+   } else {
+      cerr << "large file " << fileId << " is incomplete, upload it again to resume" << endl;
    }
 
+   if (m_verbosity > 1) {
+      const uint64_t bytesRead = UploadPartTask::totalBytesRead(uploads);
+      cerr << "uploaded " << totalBytes << " bytes in " << ranges.size() << " parts, read " << bytesRead << " bytes from disk ("
+           << std::fixed << std::setprecision(2) << (totalBytes ? static_cast<double>(bytesRead) / totalBytes : 0.0) << " per uploaded byte)" << endl;
+   }
+   m_partBuffers.clear();
+   m_uploadPartUrls.clear();
+
    for (vector<UploadPartTask*>::iterator iter = uploads.begin(); iter != uploads.end(); ++iter) {
       delete (*iter);
    }
@@ -676,118 +1234,258 @@ int BB::uploadLarge(const string& bucketId, const string& localFilePath, const s
    return rc;
 }
 
+string BB::resumeLargeFile(const string& bucketId, const string& fileName, const string& stamp, Journal& journal, vector<string>& hashes) {
+   if (!journal.load(stamp)) {
+      if (!journal.fileId().empty()) {
+         // the local file changed since the journal was written, its parts are of no use
+         try {
+            cancelLargeFile(journal.fileId());
+         } catch (const ResponseError& err) {
+            cerr << "could not cancel stale large file " << journal.fileId() << ": " << err.what() << endl;
+         }
+         journal.remove();
+      }
+      return "";
+   }
+
+   bool unfinished = false;
+   const ObjectList files = listUnfinishedLargeFiles(bucketId, fileName);
+   for (ObjectList::const_iterator iter = files.begin(); iter != files.end(); ++iter) {
+      const BB_Object file = *iter;
+      unfinished = unfinished || (file.id == journal.fileId() && file.name == fileName);
+   }
+   if (!unfinished) {
+      journal.remove();
+      return "";
+   }
+
+   // B2 is the authority on which parts arrived, the journal only has to
+   // agree where it recorded a hash of its own
+   const vector<BB_Range>& ranges = journal.ranges();
+   const map<int, string>& recorded = journal.entries();
+   hashes.assign(ranges.size(), "");
+   size_t resumed = 0;
+   const list<BB_Part> parts = listParts(journal.fileId());
+   for (list<BB_Part>::const_iterator iter = parts.begin(); iter != parts.end(); ++iter) {
+      const int index = iter->partNumber - 1;
+      if (index < 0 || index >= static_cast<int>(ranges.size()) || iter->contentLength != ranges[index].length()) {
+         continue;
+      }
+      map<int, string>::const_iterator entry = recorded.find(index);
+      if (entry == recorded.end() || entry->second == iter->contentSha1) {
+         hashes[index] = iter->contentSha1;
+         resumed++;
+      }
+   }
+
+   if (m_verbosity > 0) {
+      cerr << "resuming large file " << journal.fileId() << ", " << resumed << " of " << ranges.size() << " parts already uploaded" << endl;
+   }
+   return journal.fileId();
+}
+
 string BB::startLargeFile(const string& bucketId, const string& fileName, const string& contentType) {
-   unique_ptr<RestClient::Connection> connection = connect(m_session.apiUrl + API_URL_PATH);
+   PooledConnection connection = connect(m_session.apiUrl + API_URL_PATH);
 
    RestClient::HeaderFields headers;
    headers["Authorization"] = m_session.authorizationToken;
    headers["Content-Type"] = "application/json";
    connection->SetHeaders(headers);
 
-   Json json = Json::object();
-   json.set("bucketId", Json::string(bucketId));
-   json.set("fileName", Json::string(fileName));
-   json.set("contentType", Json::string(contentType));
+   Pool<std::string>::Lease body(m_requestBodies);
+   JsonWriter json(*body);
+   json.begin().field("bucketId", bucketId).field("fileName", fileName).field("contentType", contentType).end();
 
-   RestClient::Response response = validate(connection->post("/b2_start_large_file", json.dump()));
+   RestClient::Response response = validate(connection->post("/b2_start_large_file", json.str()));
    return Json::load(response.body).get("fileId").get<string>();
 }
 
-string BB::uploadPart(const string& uploadUrl, const string& authorizationToken, int partNumber, const BB_Range& range, ifstream& fs) const {
-   unique_ptr<RestClient::Connection> connection = connect(uploadUrl);
-
-   uint8_t sha1[EVP_MAX_MD_SIZE];
-   size_t length = computeSha1UsingRange(sha1, fs, range.start, range.end);
-
-   ostringstream sha1hex;
-   sha1hex.fill('0');
-   sha1hex << std::hex;
-
-   for (uint8_t* ptr = sha1; ptr < sha1 + length; ptr++) {
-      sha1hex << std::setw(2) << (unsigned int)(*ptr);
-   }
+void BB::uploadPart(const string& uploadUrl, const string& authorizationToken, int partNumber, Source& body, uint64_t length, const string& sha1) const {
+   PooledTransfer transfer = stream(uploadUrl);
 
    ostringstream convertPartNumber;
    convertPartNumber << partNumber;
 
-   ostringstream convertLength;
-   convertLength << range.length();
-
    RestClient::HeaderFields headers;
    headers["Authorization"] = authorizationToken;
-   //headers["Content-Type"] = "application/json; charset=utf-8";
    headers["X-Bz-Part-Number"] = convertPartNumber.str();
-   headers["X-Bz-Content-Sha1"] = sha1hex.str();
+   headers["X-Bz-Content-Sha1"] = sha1;
    if (m_testMode) {
       headers["X-Bz-Test-Mode"] = "fail_some_uploads";
    }
-   headers["Content-Length"] = convertLength.str();
+   transfer->setHeaders(headers);
 
-   connection->SetHeaders(headers);
-
-   fs.clear();
-   fs.seekg(range.start, ios_base::beg);
-
-   char* buf = new char[range.length()];
-   fs.read(buf, range.length());
-   if (fs.fail()) {
-      throw std::runtime_error("could not read file segment");
-   }
-   fs.close();
-
-   RestClient::Response response = connection->post("", string(buf, range.length()));
-   delete[] buf;
-   validate(response);
-
-   return sha1hex.str();
+   const double started = UploadStats::now();
+   validate(transfer->post("", body, length));
+   m_uploadStats.recordStream(length, UploadStats::now() - started);
 }
 
-string BB::downloadPart(const string& downloadUrl, const string& authorizationToken, int index, const BB_Range& range, ofstream& fs) const {
-   unique_ptr<RestClient::Connection> connection = connect(downloadUrl);
+void BB::downloadPart(const string& downloadUrl, const string& authorizationToken, const BB_Range& range, Sink& sink) const {
+   PooledTransfer transfer = stream(downloadUrl);
 
    RestClient::HeaderFields headers;
    headers["Authorization"] = authorizationToken;
    headers["Range"] = rangeHeader(range);
+   transfer->setHeaders(headers);
 
-   connection->SetHeaders(headers);
-
-   RestClient::Response response = connection->get("");
-   fs << response.body;
-   fs.close();
-   return "ok";
+   // bytes go from the socket to wherever the sink puts them as they arrive
+   CountingSink counted(sink);
+   validate(transfer->get("", counted));
+   if (counted.count() != range.length()) {
+      throw ResponseError(-1, "truncated", "received fewer bytes than the range requested");
+   }
 }
 
 void BB::finishLargeFile(const string& fileId, const vector<string>& hashes) {
-   unique_ptr<RestClient::Connection> connection = connect(m_session.apiUrl + API_URL_PATH);
+   PooledConnection connection = connect(m_session.apiUrl + API_URL_PATH);
 
    RestClient::HeaderFields headers;
    headers["Authorization"] = m_session.authorizationToken;
    headers["Content-Type"] = "application/json";
    connection->SetHeaders(headers);
 
-   Json json = Json::object();
-   json.set("fileId", Json::string(fileId));
-
-   Json array = Json::array();
+   // up to 10000 hashes, written straight into a body sized for them
+   Pool<std::string>::Lease body(m_requestBodies);
+   body->reserve(64 + fileId.size() + hashes.size() * 43);
+   JsonWriter json(*body);
+   json.begin().field("fileId", fileId).beginArray("partSha1Array");
    for (vector<string>::const_iterator iter = hashes.begin(); iter != hashes.end(); ++iter) {
-      array.append(Json::string(*iter));
+      json.value(*iter);
    }
-   json.set("partSha1Array", array);
+   json.endArray().end();
+
+   validate(connection->post("/b2_finish_large_file", json.str()));
+}
+
+vector<BB_Range> BB::choosePartRanges(uint64_t totalBytes, int numThreads) {
+   const uint64_t threads = std::max(1, numThreads);
+   const uint64_t minimum = absoluteMinimumPartSize();
+   // start from the part count the recommended size calls for
+   uint64_t n = (totalBytes + recommendedPartSize() - 1) / recommendedPartSize();
+   // round up to whole waves across the threads so every worker has a part
+   // and the last wave is not a handful of stragglers
+   n = ((n + threads - 1) / threads) * threads;
+   // while never cutting below the absolute minimum part size
+   n = std::min(n, std::max(static_cast<uint64_t>(1u), totalBytes / minimum));
+   n = std::min(n, static_cast<uint64_t>(MAX_FILE_PARTS));
+   n = std::max(n, (totalBytes + MAXIMUM_PART_SIZE_BYTES - 1) / MAXIMUM_PART_SIZE_BYTES);
+   return splitRanges(totalBytes, n);
+}
 
-   validate(connection->post("/b2_finish_large_file", json.dump()));
+vector<BB_Range> BB::chooseDownloadRanges(uint64_t totalBytes, int numThreads) {
+   // downloads have no part limits to respect, so ranges are kept small
+   // enough that every thread takes several and the ones still running at
+   // the end are short
+   uint64_t n = static_cast<uint64_t>(std::max(1, numThreads)) * DOWNLOAD_RANGES_PER_THREAD;
+   n = std::max(n, (totalBytes + MAXIMUM_DOWNLOAD_RANGE_BYTES - 1) / MAXIMUM_DOWNLOAD_RANGE_BYTES);
+   n = std::min(n, std::max(static_cast<uint64_t>(1u), totalBytes / MINIMUM_DOWNLOAD_RANGE_BYTES));
+   return splitRanges(totalBytes, n);
 }
 
-vector<BB_Range> BB::choosePartRanges(uint64_t totalBytes) {
+vector<BB_Range> BB::splitRanges(uint64_t totalBytes, uint64_t n) {
+   n = std::max(n, static_cast<uint64_t>(1u));
+
    vector<BB_Range> ranges;
-   const uint64_t n = std::max(static_cast<uint64_t>(1u), std::min(totalBytes / MINIMUM_PART_SIZE_BYTES, static_cast<uint64_t>(MAX_FILE_PARTS)));
    const uint64_t nminus1 = n - 1;
    const uint64_t partBytes = totalBytes / n;
-   for (int i = 0; i < n; ++i) {
+   for (uint64_t i = 0; i < n; ++i) {
       ranges.push_back(BB_Range(i * partBytes, (i < nminus1 ? (i + 1) * partBytes : totalBytes) - 1));
    }
    return ranges;
 }
 
+uint64_t BB::recommendedPartSize() const {
+   return m_session.recommendedPartSize > 0 ? m_session.recommendedPartSize : MINIMUM_PART_SIZE_BYTES;
+}
+
+uint64_t BB::absoluteMinimumPartSize() const {
+   return m_session.absoluteMinimumPartSize > 0 ? m_session.absoluteMinimumPartSize : ABSOLUTE_MINIMUM_PART_SIZE_BYTES;
+}
+
+ObjectList BB::listUnfinishedLargeFiles(const string& bucketId, const string& namePrefix) {
+   ObjectList files;
+   string startFileId;
+   do {
+      PooledConnection connection = connect(m_session.apiUrl + API_URL_PATH);
+
+      RestClient::HeaderFields headers;
+      headers["Authorization"] = m_session.authorizationToken;
+      headers["Content-Type"] = "application/json";
+      connection->SetHeaders(headers);
+
+      Pool<std::string>::Lease body(m_requestBodies);
+      JsonWriter json(*body);
+      json.begin().field("bucketId", bucketId);
+      if (!namePrefix.empty()) {
+         json.field("namePrefix", namePrefix);
+      }
+      if (!startFileId.empty()) {
+         json.field("startFileId", startFileId);
+      }
+      json.field("maxFileCount", 100).end();
+
+      RestClient::Response response = validate(connection->post("/b2_list_unfinished_large_files", json.str()));
+      const ObjectList page = unpackObjectsList(response.body, NULL, &startFileId);
+      for (ObjectList::const_iterator iter = page.begin(); iter != page.end(); ++iter) {
+         files.push_back(*iter);
+      }
+   } while (!startFileId.empty());
+   return files;
+}
+
+list<BB_Part> BB::listParts(const string& fileId) {
+   list<BB_Part> parts;
+   int startPartNumber = 1;
+   do {
+      PooledConnection connection = connect(m_session.apiUrl + API_URL_PATH);
+
+      RestClient::HeaderFields headers;
+      headers["Authorization"] = m_session.authorizationToken;
+      headers["Content-Type"] = "application/json";
+      connection->SetHeaders(headers);
+
+      Pool<std::string>::Lease body(m_requestBodies);
+      JsonWriter json(*body);
+      json.begin().field("fileId", fileId).field("startPartNumber", startPartNumber).field("maxPartCount", 1000).end();
+
+      RestClient::Response response = validate(connection->post("/b2_list_parts", json.str()));
+
+      Json root = Json::load(response.body);
+      Json array = root.get("parts");
+      for (int i = 0; array.isArray() && i < array.size(); ++i) {
+         Json elem = array.at(i);
+         if (elem.isObject() && elem.get("partNumber").isInteger()) {
+            BB_Part part;
+            part.partNumber = elem.get("partNumber").get<int>();
+            if (elem.get("contentLength").isInteger())
+               part.contentLength = elem.get("contentLength").get<uint64_t>();
+            if (elem.get("contentSha1").isString())
+               part.contentSha1 = elem.get("contentSha1").get<string>();
+            parts.push_back(part);
+         }
+      }
+
+      Json nextPartNumber = root.get("nextPartNumber");
+      startPartNumber = nextPartNumber.isInteger() ? nextPartNumber.get<int>() : 0;
+   } while (startPartNumber > 0);
+   return parts;
+}
+
+void BB::cancelLargeFile(const string& fileId) {
+   PooledConnection connection = connect(m_session.apiUrl + API_URL_PATH);
+
+   RestClient::HeaderFields headers;
+   headers["Authorization"] = m_session.authorizationToken;
+   headers["Content-Type"] = "application/json";
+   connection->SetHeaders(headers);
+
+   Pool<std::string>::Lease body(m_requestBodies);
+   JsonWriter json(*body);
+   json.begin().field("fileId", fileId).end();
+
+   validate(connection->post("/b2_cancel_large_file", json.str()));
+}
+
 string BB::rangeHeader(const BB_Range& range) const {
    ostringstream start;
    ostringstream end;
@@ -797,7 +1495,7 @@ string BB::rangeHeader(const BB_Range& range) const {
 }
 
 list<BB_Bucket> BB::listBuckets() {
-   unique_ptr<RestClient::Connection> connection = connect(m_session.apiUrl + API_URL_PATH);
+   PooledConnection connection = connect(m_session.apiUrl + API_URL_PATH);
 
    RestClient::HeaderFields headers;
    headers["Authorization"] = m_session.authorizationToken;
@@ -807,27 +1505,45 @@ list<BB_Bucket> BB::listBuckets() {
    return unpackBucketsList(response.body);
 }
 
-list<BB_Object> BB::listBucket(const string& bucketName, const string& startFileName, int maxFileCount) {
-   const int maxFileCountDefaults[2] = { 0, 100 }; // 0 means show 100, 100 means show 100
-   const int maxFileCountLimit = 1000;
+ObjectList BB::listBucket(const string& bucketName, const string& startFileName, int maxFileCount, const string& prefix, const string& delimiter) {
+   // 0 has always meant the default of 100, the listing follows pages
+   // beyond the per request limit for anything larger
+   FileNameListing listing(*this, getBucket(bucketName).id, startFileName, maxFileCount > 0 ? maxFileCount : 100, prefix, delimiter);
 
-   unique_ptr<RestClient::Connection> connection = connect(m_session.apiUrl + API_URL_PATH);
+   ObjectList files;
+   BB_Object object;
+   while (listing.next(object)) {
+      files.push_back(object);
+   }
+   return files;
+}
+
+ObjectList BB::listFileNames(const string& bucketId, const string& startFileName, int maxFileCount, string& nextFileName, const string& prefix, const string& delimiter) {
+   PooledConnection connection = connect(m_session.apiUrl + API_URL_PATH);
 
    RestClient::HeaderFields headers;
    headers["Authorization"] = m_session.authorizationToken;
    connection->SetHeaders(headers);
 
-   Json json = Json::object();
-   json.set("bucketId", Json::string(getBucket(bucketName).id));
+   Pool<std::string>::Lease body(m_requestBodies);
+   JsonWriter json(*body);
+   json.begin().field("bucketId", bucketId);
    if (startFileName.size() > 0) {
-      json.set("startFileName", Json::string(startFileName));
+      json.field("startFileName", startFileName);
    }
-   if (maxFileCount != maxFileCountDefaults[0] && maxFileCount != maxFileCountDefaults[1]) {
-      maxFileCount = std::max(maxFileCount, maxFileCountLimit);
-      json.set("maxFileCount", Json::integer(maxFileCount));
+   json.field("maxFileCount", std::min(std::max(maxFileCount, 1), FileNameListing::MAX_PAGE_FILE_COUNT));
+   // B2 skips straight to the prefix, so a folder costs what is in it
+   // rather than everything sorted before it
+   if (!prefix.empty()) {
+      json.field("prefix", prefix);
    }
-   RestClient::Response response = validate(connection->post("/b2_list_file_names", json.dump()));
-   return unpackObjectsList(response.body);
+   if (!delimiter.empty()) {
+      json.field("delimiter", delimiter);
+   }
+   json.end();
+
+   RestClient::Response response = validate(connection->post("/b2_list_file_names", json.str()));
+   return unpackObjectsList(response.body, &nextFileName);
 }
 
 } // namespace khi
@@ -40,6 +40,9 @@
 #include "multidict.h"
 #include "session.h"
 #include "dispatcho.h"
+#include "pool.h"
+#include "object_list.h"
+#include "upload_stats.h"
 
 namespace RestClient { 
    class Connection;
@@ -48,6 +51,12 @@ namespace RestClient {
 namespace khi {
 
 class Json;
+class Source;
+class Journal;
+class Transfer;
+class Sink;
+class ReorderRing;
+class OrderedDigest;
 
 struct BB_Object { 
    std::string id;
@@ -55,6 +64,7 @@ struct BB_Object {
    uint64_t contentLength;
    std::string contentType; 
    std::string contentSha1; 
+   std::string largeFileSha1;
    std::string action; 
    uint64_t uploadTimestamp;
 
@@ -65,12 +75,20 @@ struct BB_Bucket {
    std::string id; 
    std::string name; 
    std::string type;
-   std::list<BB_Object> objects;
+   ObjectList objects;
 
    BB_Bucket(const std::string& _id, const std::string& _name, const std::string& _type) 
       : id(_id), name(_name), type(_type) {} 
 };
 
+struct BB_Part {
+   int partNumber;
+   uint64_t contentLength;
+   std::string contentSha1;
+
+   BB_Part() : partNumber(0), contentLength(0) {}
+};
+
 struct BB_Range {
    uint64_t start;
    uint64_t end;
@@ -87,7 +105,7 @@ class UploadPartTask : public Task {
 
    public:
 
-   UploadPartTask(const BB& bb, const std::string& fileId, const BB_Range& range, int index, const std::string& filepath);
+   UploadPartTask(const BB& bb, const std::string& fileId, const BB_Range& range, int index, const std::string& filepath, Journal& journal);
    UploadPartTask(const UploadPartTask&);
 
    virtual ~UploadPartTask();
@@ -98,55 +116,107 @@ class UploadPartTask : public Task {
       return m_hash;
    }
 
-   static std::vector<std::string> map(const std::vector<UploadPartTask*>& uploads);
-   static std::string result(const UploadPartTask* task);
+   inline uint64_t bytesRead() const {
+      return m_bytesRead;
+   }
+
+   inline int index() const {
+      return m_index;
+   }
+
+   static uint64_t totalBytesRead(const std::vector<UploadPartTask*>& uploads);
 
    private:
 
    UploadPartTask& operator=(const UploadPartTask&); // prevent assign
 
+   std::string readPart(std::vector<char>& buffer);
+
    const BB& m_bb;
    const std::string& m_fileId;
    const BB_Range& m_range;
    const int m_index;
    const std::string& m_filepath;
+   Journal& m_journal;
    std::string m_hash;
+   uint64_t m_bytesRead;
 };
 
 class DownloadPartTask : public Task {
 
    public:
 
-   DownloadPartTask(const BB& bb, const std::string& authorizationToken, const std::string& downloadUrl, const BB_Range& range, int index, const std::string& filepath);
+   DownloadPartTask(const BB& bb, const std::string& authorizationToken, const std::string& downloadUrl, const BB_Range& range, int index, int fd, uint64_t done, Journal& journal, OrderedDigest* digest);
    DownloadPartTask(const DownloadPartTask&);
 
    virtual ~DownloadPartTask();
 
    virtual int run();
 
-   static const std::string filepart(const std::string& path, int index);
-   static void coalesce(const std::string& filepath, const std::vector<DownloadPartTask*>& downloads);
-   static void cleanup(const std::string& filepath, const std::vector<DownloadPartTask*>& downloads);
-
    private:
 
    DownloadPartTask& operator=(const DownloadPartTask&); // prevent assign
 
-   static const std::string downloadPath(const std::string& filepath);
+   void record();
 
    const BB& m_bb;
    const std::string& m_authorizationToken;
    const std::string& m_downloadUrl;
    const BB_Range& m_range;
    const int m_index;
-   const std::string& m_filepath;
-   std::string m_result;
+   const int m_fd;
+   uint64_t m_done;
+   Journal& m_journal;
+   OrderedDigest* m_digest;
+};
+
+class StreamPartTask : public Task {
+
+   public:
+
+   StreamPartTask(const BB& bb, const std::string& authorizationToken, const std::string& downloadUrl, const std::vector<BB_Range>& ranges, ReorderRing& ring);
+   StreamPartTask(const StreamPartTask&);
+
+   virtual ~StreamPartTask();
+
+   virtual int run();
+
+   private:
+
+   StreamPartTask& operator=(const StreamPartTask&); // prevent assign
+
+   void fetch(const BB_Range& range, std::vector<char>& buffer);
+
+   const BB& m_bb;
+   const std::string& m_authorizationToken;
+   const std::string& m_downloadUrl;
+   const std::vector<BB_Range>& m_ranges;
+   ReorderRing& m_ring;
+};
+
+class ListBucketTask : public Task {
+
+   public:
+
+   ListBucketTask(BB& bb, BB_Bucket& bucket);
+
+   virtual int run();
+
+   private:
+
+   ListBucketTask(const ListBucketTask&); // prevent copy
+   ListBucketTask& operator=(const ListBucketTask&); // prevent assign
+
+   BB& m_bb;
+   BB_Bucket& m_bucket;
 };
 
 class BB {
 
    friend class UploadPartTask;
+   friend class ListBucketTask;
    friend class DownloadPartTask;
+   friend class StreamPartTask;
 
    const std::string m_accountId;
    const std::string m_applicationKey;
@@ -157,15 +227,43 @@ class BB {
 
    bool m_testMode;
 
+   int m_verbosity;
+
+   bool m_bufferedUploads;
+
+   uint64_t m_splitThreshold;
+
+   int m_bucketThreads;
+
+   // guards the objects of m_buckets while they are filled in parallel
+   pthread_mutex_t m_bucketsMutex;
+
+   // part sized buffers for buffered uploads, reused by whichever worker
+   // picks up the next part
+   mutable Pool<std::vector<char> > m_partBuffers;
+
    static const std::string API_URL_PATH;
    static const int MINIMUM_PART_SIZE_BYTES;
    static const int MINIMUM_SPLIT_SIZE_BYTES;
    static const int MAX_FILE_PARTS;
+   static const uint64_t ABSOLUTE_MINIMUM_PART_SIZE_BYTES;
+   static const uint64_t MAXIMUM_PART_SIZE_BYTES;
+   static const uint64_t MINIMUM_DOWNLOAD_RANGE_BYTES;
+   static const uint64_t MAXIMUM_DOWNLOAD_RANGE_BYTES;
+   static const int DOWNLOAD_RANGES_PER_THREAD;
+   static const int SPLIT_PARTS_PER_THREAD;
+   static const int SPLIT_EXTRA_CALLS;
+   static const int SPLIT_BENEFIT_MARGIN;
+   static const int DEFAULT_DOWNLOAD_THREADS;
+   static const size_t DOWNLOAD_DIGEST_WINDOW_BYTES;
+   static const uint64_t STREAM_RANGE_BYTES;
    static const int DEFAULT_UPLOAD_RETRY_ATTEMPTS;
+   static const int BUCKET_CACHE_TTL_SECONDS;
+   static const int DEFAULT_BUCKET_THREADS;
     
    static std::list<BB_Bucket> unpackBucketsList(const std::string& json);
 
-   static std::list<BB_Object> unpackObjectsList(const std::string& json);
+   static ObjectList unpackObjectsList(const std::string& json, std::string* nextFileName = NULL, std::string* nextFileId = NULL);
 
    static BB_Object unpackObject(const Json& json);
 
@@ -181,12 +279,21 @@ class BB {
    BB_Bucket getBucket(const std::string& bucketName); 
                                      
    void refreshBuckets(bool getContents);
+
+   // the bucket list of the last b2_list_buckets is kept next to the
+   // session so a new process can map names to ids without asking again
+   bool loadBucketCache();
+
+   void saveBucketCache() const;
+
+   void invalidateBucketCache();
     
    int uploadFile(const std::string& bucketName, const std::string& localFileName, const std::string& remoteFileName, const std::string& contentType, int numThreads = 1);
    
-   int downloadFileById(const std::string& fileId, const std::string& localFilePath, int numThreads = 1);
+   // numThreads of zero picks the download concurrency automatically
+   int downloadFileById(const std::string& fileId, const std::string& localFilePath, int numThreads = 0);
      
-   int downloadFileByName(const std::string& bucketName, const std::string& remoteFileName, std::ofstream& fout, int numThreads = 1);
+   int downloadFileByName(const std::string& bucketName, const std::string& remoteFileName, const std::string& localFilePath, int numThreads = 0);
 
    void deleteFileVersion(const std::string& fileName, const std::string& fileId);
 
@@ -196,13 +303,24 @@ class BB {
 
    void updateBucket(const std::string& bucketId, const std::string& bucketType);
 
-   std::list<BB_Object> listFileVersions(const std::string& bucketId, const std::string& startFileName = "", const std::string& startFileId = "", int maxFileCount = 0);
+   // a delimiter collapses everything past it into a single folder entry
+   ObjectList listFileVersions(const std::string& bucketId, const std::string& startFileName = "", const std::string& startFileId = "", int maxFileCount = 0, const std::string& prefix = "", const std::string& delimiter = "");
    
-   std::list<BB_Object> listBucket(const std::string& bucketName, const std::string& startFileName = "", int maxFileCount = 100);
+   ObjectList listBucket(const std::string& bucketName, const std::string& startFileName = "", int maxFileCount = 100, const std::string& prefix = "", const std::string& delimiter = "");
+
+   // one page of b2_list_file_names, nextFileName is left empty after the last
+   ObjectList listFileNames(const std::string& bucketId, const std::string& startFileName, int maxFileCount, std::string& nextFileName, const std::string& prefix = "", const std::string& delimiter = "");
 
    const BB_Object getFileInfo(const std::string& fileId);
 
    void hideFile(const std::string& bucketName, const std::string& fileName);
+
+   ObjectList listUnfinishedLargeFiles(const std::string& bucketId, const std::string& namePrefix = "");
+
+   std::list<BB_Part> listParts(const std::string& fileId);
+
+   void cancelLargeFile(const std::string& fileId);
+
    struct UploadUrlInfo {
       std::string bucketOrFileId;
       std::string uploadUrl;
@@ -211,31 +329,88 @@ class BB {
 
    const UploadUrlInfo getUploadUrl(const std::string& bucketId) const;
 
+   static bool expiredUploadUrl(int status);
+
+   static bool transientFailure(int status);
+
    const UploadUrlInfo getUploadPartUrl(const std::string& fileId) const;
 
    int uploadRetryAttempts() const;
 
    bool useTestMode();
 
+   void setVerbosity(int verbosity);
+
+   void setBufferedUploads(bool buffered);
+
+   bool bufferedUploads() const;
+
+   // files of at least this many bytes are uploaded in parts, zero picks
+   // the size at which the threads save more than the extra large file
+   // calls cost, going by what earlier uploads measured
+   void setSplitThreshold(uint64_t bytes);
+
+   uint64_t splitThreshold(int numThreads) const;
+
+   // how many buckets refreshBuckets(true) lists at once
+   void setBucketThreads(int numThreads);
+
    private:
 
+   // upload part urls handed from one part to the next, so that each worker
+   // keeps the url it has for as long as B2 keeps accepting it
+   mutable Pool<UploadUrlInfo> m_uploadPartUrls;
+
+   // request bodies keep their capacity from one request to the next
+   mutable Pool<std::string> m_requestBodies;
+
+   // stream throughput and call latency of earlier uploads, recorded from
+   // the part workers as well
+   mutable UploadStats m_uploadStats;
+
+   // keep-alive connections for API calls and streamed transfers, keyed by
+   // base url and safe to lease from any worker thread
+   mutable KeyedPool<RestClient::Connection> m_connections;
+   mutable KeyedPool<Transfer> m_transfers;
+
+   typedef KeyedPool<RestClient::Connection>::Handle PooledConnection;
+   typedef KeyedPool<Transfer>::Handle PooledTransfer;
+
    int uploadSmall(const std::string& bucketId, const std::string& localFilePath, const std::string& remoteFileName, const std::string& contentType, uint64_t totalBytes);
 
    int uploadLarge(const std::string& buckedId, const std::string& localFilePath, const std::string& remoteFileName, const std::string& contentType, uint64_t totalBytes, int numThreads = 1);
 
    std::string startLargeFile(const std::string& bucketId, const std::string& fileName, const std::string& contentType);
 
-   std::string uploadPart(const std::string& uploadUrl, const std::string& authorizationToken, int partNumber, const BB_Range& range, std::ifstream& fs) const;
+   std::string resumeLargeFile(const std::string& bucketId, const std::string& fileName, const std::string& stamp, Journal& journal, std::vector<std::string>& hashes);
 
-   std::string downloadPart(const std::string& downloadUrl, const std::string& authorizationToken, int partNumber, const BB_Range& range, std::ofstream& fs) const;
+   void uploadPart(const std::string& uploadUrl, const std::string& authorizationToken, int partNumber, Source& body, uint64_t length, const std::string& sha1) const;
+
+   int downloadRanges(const std::string& downloadUrl, const BB_Object& object, const std::string& localFilePath, int numThreads);
+
+   int streamRanges(const std::string& downloadUrl, const BB_Object& object, int numThreads);
+
+   void downloadPart(const std::string& downloadUrl, const std::string& authorizationToken, const BB_Range& range, Sink& sink) const;
+
+   static std::string expectedSha1(const BB_Object& object);
 
    void finishLargeFile(const std::string& fileId, const std::vector<std::string>& partsSha1);
 
-   std::vector<BB_Range> choosePartRanges(uint64_t totalBytes);
+   std::vector<BB_Range> choosePartRanges(uint64_t totalBytes, int numThreads = 1);
+
+   std::vector<BB_Range> chooseDownloadRanges(uint64_t totalBytes, int numThreads);
+
+   static std::vector<BB_Range> splitRanges(uint64_t totalBytes, uint64_t n);
+
+   uint64_t recommendedPartSize() const;
+
+   uint64_t absoluteMinimumPartSize() const;
 
    std::string rangeHeader(const BB_Range& range) const;
 
-   std::unique_ptr<RestClient::Connection> connect(const std::string& baseUrl) const;
+   PooledConnection connect(const std::string& baseUrl) const;
+
+   PooledTransfer stream(const std::string& baseUrl) const;
  
    std::list<BB_Bucket> listBuckets();
 };
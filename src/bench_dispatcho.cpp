@@ -0,0 +1,98 @@
+// vim:set et ts=3 sw=3:
+// __  __ ______ _______ _______ _______ ______ 
+// |  |/  |   __ \   |   |     __|    ___|   __ \
+// |     <|      <   |   |    |  |    ___|      <
+// |__|\__|___|__|_______|_______|_______|___|__|
+//        H E A V Y  I N D U S T R I E S
+//
+// Copyright (C) 2024 Kruger Heavy Industries
+// http://www.krugerheavyindustries.com
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty.  In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+
+// Measures what Dispatcho costs per task: N tasks that do nothing are
+// queued from one thread on pools of 1, 4 and 16 workers, and the time
+// from the first async() to workoff() returning is divided among them.
+//
+//    make bench_dispatcho && ./bench_dispatcho [<tasks>]
+
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <sys/time.h>
+
+#include "dispatcho.h"
+
+using namespace std;
+using namespace khi;
+
+namespace {
+
+   const int WORKERS[] = { 1, 4, 16 };
+
+   class Noop : public Task {
+
+      public:
+
+      Noop() : Task(NULL, "noop_task"), runs(0) {}
+
+      virtual int run() {
+         runs++;
+         return EXIT_SUCCESS;
+      }
+
+      int runs;
+   };
+
+   double now() {
+      struct timeval tv;
+      gettimeofday(&tv, NULL);
+      return tv.tv_sec + tv.tv_usec / 1e6;
+   }
+}
+
+int main(int argc, char* argv[]) {
+   const int count = argc > 1 ? atoi(argv[1]) : 100000;
+   cout << count << " tasks" << endl;
+
+   for (size_t w = 0; w < sizeof(WORKERS) / sizeof(WORKERS[0]); ++w) {
+      vector<Noop> tasks(count);
+      Dispatcho dispatcho(WORKERS[w]);
+
+      const double start = now();
+      for (vector<Noop>::iterator iter = tasks.begin(); iter != tasks.end(); ++iter) {
+         dispatcho.async(&*iter);
+      }
+      const int rc = dispatcho.workoff();
+      const double elapsed = now() - start;
+
+      // each task is touched by the one worker that took it, and workoff()
+      // has joined them all
+      int runs = 0;
+      for (vector<Noop>::const_iterator iter = tasks.begin(); iter != tasks.end(); ++iter) {
+         runs += iter->runs;
+      }
+
+      cout << WORKERS[w] << " workers: " << elapsed * 1e9 / count << " ns/task";
+      if (rc != EXIT_SUCCESS || runs != count) {
+         cout << " (" << runs << " of " << count << " tasks ran)";
+      }
+      cout << endl;
+   }
+   return EXIT_SUCCESS;
+}
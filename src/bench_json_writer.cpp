@@ -0,0 +1,155 @@
+// vim:set et ts=3 sw=3:
+// __  __ ______ _______ _______ _______ ______ 
+// |  |/  |   __ \   |   |     __|    ___|   __ \
+// |     <|      <   |   |    |  |    ___|      <
+// |__|\__|___|__|_______|_______|_______|___|__|
+//        H E A V Y  I N D U S T R I E S
+//
+// Copyright (C) 2024 Kruger Heavy Industries
+// http://www.krugerheavyindustries.com
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty.  In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+
+// Builds B2 request bodies both with JsonWriter and as a Json tree that is
+// then dumped, the way they were built before, and prints the time each
+// takes: a b2_finish_large_file body with 10000 part hashes, and the small
+// b2_list_file_names body sent for every page of a listing.
+//
+//    make bench_json_writer && ./bench_json_writer [<rounds>]
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <sys/time.h>
+
+#include "jsoncpp.h"
+#include "json_writer.h"
+
+using namespace std;
+using namespace khi;
+
+namespace {
+
+   const int PART_COUNT = 10000;
+   const int SMALL_BODIES_PER_ROUND = 10000;
+
+   const string FILE_ID = "4_ze73ede9c9c8412db49f60715_f200b4e93fbae6252_d20150809_m012345_c100_v0009990_t0034";
+   const string BUCKET_ID = "e73ede9c9c8412db49f60715";
+   const string START_FILE_NAME = "photos/2016/album-42/IMG_4200.jpg";
+   const string PREFIX = "photos/2016/";
+
+   double now() {
+      struct timeval tv;
+      gettimeofday(&tv, NULL);
+      return tv.tv_sec + tv.tv_usec / 1e6;
+   }
+
+   string finishWithTree(const vector<string>& hashes) {
+      Json json = Json::object();
+      json.set("fileId", Json::string(FILE_ID));
+      Json array = Json::array();
+      for (vector<string>::const_iterator iter = hashes.begin(); iter != hashes.end(); ++iter) {
+         array.append(Json::string(*iter));
+      }
+      json.set("partSha1Array", array);
+      return json.dump();
+   }
+
+   const string& finishWithWriter(const vector<string>& hashes, string& body) {
+      body.reserve(64 + FILE_ID.size() + hashes.size() * 43);
+      JsonWriter json(body);
+      json.begin().field("fileId", FILE_ID).beginArray("partSha1Array");
+      for (vector<string>::const_iterator iter = hashes.begin(); iter != hashes.end(); ++iter) {
+         json.value(*iter);
+      }
+      json.endArray().end();
+      return json.str();
+   }
+
+   string listWithTree() {
+      Json json = Json::object();
+      json.set("bucketId", Json::string(BUCKET_ID));
+      json.set("startFileName", Json::string(START_FILE_NAME));
+      json.set("maxFileCount", Json::integer(10000));
+      json.set("prefix", Json::string(PREFIX));
+      return json.dump();
+   }
+
+   const string& listWithWriter(string& body) {
+      JsonWriter json(body);
+      json.begin().field("bucketId", BUCKET_ID).field("startFileName", START_FILE_NAME)
+          .field("maxFileCount", 10000).field("prefix", PREFIX).end();
+      return json.str();
+   }
+
+   // both ways have to say the same thing, whatever their spacing
+   bool same(const string& a, const string& b) {
+      return Json::load(a).dump() == Json::load(b).dump();
+   }
+}
+
+int main(int argc, char* argv[]) {
+   const int rounds = argc > 1 ? atoi(argv[1]) : 20;
+
+   vector<string> hashes;
+   for (int i = 0; i < PART_COUNT; ++i) {
+      ostringstream hash;
+      hash << hex << (0x10000000u + i) << "a1b2c3d4e5f60718293a4b5c6d7e8f90";
+      hashes.push_back(hash.str());
+   }
+
+   string body;
+   if (!same(finishWithTree(hashes), finishWithWriter(hashes, body)) || !same(listWithTree(), listWithWriter(body))) {
+      cerr << "the two builders disagree" << endl;
+      return EXIT_FAILURE;
+   }
+
+   double start = now();
+   for (int i = 0; i < rounds; ++i) {
+      finishWithTree(hashes);
+   }
+   const double finishTree = (now() - start) / rounds;
+
+   start = now();
+   for (int i = 0; i < rounds; ++i) {
+      finishWithWriter(hashes, body);
+   }
+   const double finishWriter = (now() - start) / rounds;
+
+   start = now();
+   for (int i = 0; i < rounds * SMALL_BODIES_PER_ROUND; ++i) {
+      listWithTree();
+   }
+   const double listTree = (now() - start) / (rounds * SMALL_BODIES_PER_ROUND);
+
+   start = now();
+   for (int i = 0; i < rounds * SMALL_BODIES_PER_ROUND; ++i) {
+      listWithWriter(body);
+   }
+   const double listWriter = (now() - start) / (rounds * SMALL_BODIES_PER_ROUND);
+
+   cout << "b2_finish_large_file, " << PART_COUNT << " parts, " << rounds << " rounds" << endl;
+   cout << "   json tree: " << finishTree * 1e3 << " ms/body" << endl;
+   cout << "   writer:    " << finishWriter * 1e3 << " ms/body" << endl;
+   cout << "b2_list_file_names, " << rounds * SMALL_BODIES_PER_ROUND << " bodies" << endl;
+   cout << "   json tree: " << listTree * 1e6 << " us/body" << endl;
+   cout << "   writer:    " << listWriter * 1e6 << " us/body" << endl;
+   return EXIT_SUCCESS;
+}
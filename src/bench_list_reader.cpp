@@ -0,0 +1,146 @@
+// vim:set et ts=3 sw=3:
+// __  __ ______ _______ _______ _______ ______ 
+// |  |/  |   __ \   |   |     __|    ___|   __ \
+// |     <|      <   |   |    |  |    ___|      <
+// |__|\__|___|__|_______|_______|_______|___|__|
+//        H E A V Y  I N D U S T R I E S
+//
+// Copyright (C) 2024 Kruger Heavy Industries
+// http://www.krugerheavyindustries.com
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty.  In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+
+// Decodes a synthetic b2_list_file_names page of 10000 files both with
+// ListReader and by loading it into a Json tree first, the way list
+// responses were read before, and prints the time each takes per page.
+//
+//    make bench_list_reader && ./bench_list_reader [<rounds>]
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <cstdlib>
+#include <sys/time.h>
+
+#include "bb.h"
+#include "jsoncpp.h"
+#include "list_reader.h"
+#include "object_list.h"
+
+using namespace std;
+using namespace khi;
+
+namespace {
+
+   const int PAGE_FILE_COUNT = 10000;
+
+   string page() {
+      ostringstream strm;
+      strm << "{\n  \"files\": [\n";
+      for (int i = 0; i < PAGE_FILE_COUNT; ++i) {
+         strm << "    {\n"
+              << "      \"accountId\": \"0123456789ab\",\n"
+              << "      \"action\": \"upload\",\n"
+              << "      \"bucketId\": \"e73ede9c9c8412db49f60715\",\n"
+              << "      \"contentLength\": " << (1000 + i * 37) << ",\n"
+              << "      \"contentSha1\": \"" << hex << (0x10000000u + i) << "a1b2c3d4e5f60718293a4b5c6d7e8f90" << dec << "\",\n"
+              << "      \"contentType\": \"application/octet-stream\",\n"
+              << "      \"fileId\": \"4_ze73ede9c9c8412db49f60715_f100b4e93fbae6252_d20150809_m012345_c100_v0009990_t" << (1000 + i % 9000) << "\",\n"
+              << "      \"fileInfo\": {\n"
+              << "        \"src_last_modified_millis\": \"1439083617220\"\n"
+              << "      },\n"
+              << "      \"fileName\": \"photos/2016/album-" << (i / 100) << "/IMG_" << i << ".jpg\",\n"
+              << "      \"uploadTimestamp\": " << (1439083617000ull + i) << "\n"
+              << "    }" << (i + 1 < PAGE_FILE_COUNT ? "," : "") << "\n";
+      }
+      strm << "  ],\n  \"nextFileName\": \"photos/2016/album-100/IMG_10000.jpg\"\n}\n";
+      return strm.str();
+   }
+
+   double now() {
+      struct timeval tv;
+      gettimeofday(&tv, NULL);
+      return tv.tv_sec + tv.tv_usec / 1e6;
+   }
+
+   size_t readInOnePass(const string& body, string& nextFileName) {
+      ObjectList files;
+      ListCollector collector(files);
+      ListReader reader(body.data(), body.size());
+      reader.read(collector);
+      nextFileName = reader.nextFileName();
+      return files.size();
+   }
+
+   string text(const Json& json) {
+      return json.isString() ? json.get<string>() : "";
+   }
+
+   size_t readThroughTree(const string& body, string& nextFileName) {
+      ObjectList files;
+      Json root = Json::load(body);
+      Json array = root.get("files");
+      for (int i = 0; i < array.size(); ++i) {
+         Json elem = array.at(i);
+         BB_Object object;
+         object.action = text(elem.get("action"));
+         object.contentLength = elem.get("contentLength").get<uint64_t>();
+         object.contentType = text(elem.get("contentType"));
+         object.contentSha1 = text(elem.get("contentSha1"));
+         Json fileInfo = elem.get("fileInfo");
+         if (fileInfo.isObject()) {
+            object.largeFileSha1 = text(fileInfo.get("large_file_sha1"));
+         }
+         object.id = text(elem.get("fileId"));
+         object.name = text(elem.get("fileName"));
+         object.uploadTimestamp = elem.get("uploadTimestamp").get<uint64_t>();
+         files.push_back(object);
+      }
+      nextFileName = text(root.get("nextFileName"));
+      return files.size();
+   }
+}
+
+int main(int argc, char* argv[]) {
+   const int rounds = argc > 1 ? atoi(argv[1]) : 20;
+   const string body = page();
+   cout << "page of " << PAGE_FILE_COUNT << " files, " << body.size() << " bytes, " << rounds << " rounds" << endl;
+
+   string onePassNext;
+   string treeNext;
+   if (readInOnePass(body, onePassNext) != readThroughTree(body, treeNext) || onePassNext != treeNext) {
+      cerr << "the two readers disagree" << endl;
+      return EXIT_FAILURE;
+   }
+
+   double start = now();
+   for (int i = 0; i < rounds; ++i) {
+      readThroughTree(body, treeNext);
+   }
+   const double tree = (now() - start) / rounds;
+
+   start = now();
+   for (int i = 0; i < rounds; ++i) {
+      readInOnePass(body, onePassNext);
+   }
+   const double onePass = (now() - start) / rounds;
+
+   cout << "json tree: " << tree * 1000 << " ms/page" << endl;
+   cout << "one pass:  " << onePass * 1000 << " ms/page" << endl;
+   return EXIT_SUCCESS;
+}
@@ -74,6 +74,8 @@ int main(int argc, char * argv[]) {
    commands.add<HideFile>("hide_file");
    commands.add<ListFileVersions>("list_file_versions");
    commands.add<DeleteFileVersion>("delete_file_version");
+   commands.add<IndexBucket>("index_bucket");
+   commands.add<LookupFile>("lookup_file");
 
    MimeTypes::initialize();
     
@@ -84,6 +86,10 @@ int main(int argc, char * argv[]) {
    cmds.flags.insert("-t"); // type (Content-Type)
    cmds.flags.insert("-m"); // metadata
    cmds.flags.insert("-x"); // test mode
+   cmds.flags.insert("-n"); // number of threads
+   cmds.flags.insert("-s"); // split threshold in bytes
+   cmds.flags.insert("-p"); // listing prefix
+   cmds.flags.insert("-D"); // listing delimiter
    cmds.parse(argc, argv);
     
    string accountId;
@@ -104,9 +110,9 @@ int main(int argc, char * argv[]) {
    }
 
    if (cmds.hasFlag("-d")) {
-      int verbosity = cmds.opts.getWithDefault("-d", 2);
+      verbosity = cmds.opts.getWithDefault("-d", 2);
       if (verbosity > 0) {
-         cout << "Verbose output level " << verbosity << endl;
+         cerr << "Verbose output level " << verbosity << endl;
       }
    }
 
@@ -166,6 +172,7 @@ int main(int argc, char * argv[]) {
       try {
          // Create and configure blazer
          BB bb(accountId, applicationKey);
+         bb.setVerbosity(verbosity);
          bb.authorize();
 
          result = commands[cmds.words[0]]->execute(cmds.words.size(), cmds, bb);
@@ -0,0 +1,377 @@
+// vim:set et ts=3 sw=3:
+// __  __ ______ _______ _______ _______ ______ 
+// |  |/  |   __ \   |   |     __|    ___|   __ \
+// |     <|      <   |   |    |  |    ___|      <
+// |__|\__|___|__|_______|_______|_______|___|__|
+//        H E A V Y  I N D U S T R I E S
+//
+// Copyright (C) 2024 Kruger Heavy Industries
+// http://www.krugerheavyindustries.com
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty.  In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "bucket_index.h"
+
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "coding.h"
+#include "session.h"
+#include "listing.h"
+
+using namespace std;
+
+namespace khi {
+
+namespace {
+
+   const char MAGIC[8] = { 'b', 'l', 'z', 'i', 'd', 'x', '0', '1' };
+
+   enum Flags {
+      HAS_SHA1 = 1,
+      LARGE_FILE_SHA1 = 2,
+      UNVERIFIED_SHA1 = 4
+   };
+
+   const string UNVERIFIED = "unverified:";
+
+   const char* const ACTIONS[] = { "upload", "hide", "start", "folder" };
+   const size_t ACTION_COUNT = sizeof(ACTIONS) / sizeof(ACTIONS[0]);
+
+   bool startsWith(const string& name, const string& prefix) {
+      return name.compare(0, prefix.size(), prefix) == 0;
+   }
+
+   // B2 marks hashes the client supplied after the upload as unverified:<hex>
+   uint32_t packSha1(const string& sha1, uint8_t* out) {
+      if (decodeHex(sha1, out, 20)) {
+         return HAS_SHA1;
+      }
+      if (startsWith(sha1, UNVERIFIED) && decodeHex(sha1.substr(UNVERIFIED.size()), out, 20)) {
+         return HAS_SHA1 | UNVERIFIED_SHA1;
+      }
+      return 0;
+   }
+}
+
+struct BucketIndex::Header {
+   char magic[8];
+   uint64_t count;
+   uint64_t stringsOffset;
+   uint64_t refreshed;
+   uint32_t recordSize;
+   uint32_t reserved;
+};
+
+struct BucketIndex::Record {
+   uint64_t nameOffset;
+   uint64_t idOffset;
+   uint64_t typeOffset;
+   uint32_t nameLength;
+   uint32_t idLength;
+   uint32_t typeLength;
+   uint32_t flags;
+   uint64_t contentLength;
+   uint64_t uploadTimestamp;
+   uint8_t sha1[20];
+   uint8_t action;
+   uint8_t reserved[3];
+};
+
+// Streams records into the new index as they come, in order, with their
+// strings going to a side file that is appended once the count is known.
+// Both files go again unless finish() completes.
+class BucketIndex::Writer {
+
+   public:
+
+   explicit Writer(const string& path)
+      :  m_path(path),
+         m_stringsPath(path + ".strings"),
+         m_records(path.c_str(), ios::binary | ios::trunc),
+         m_strings(m_stringsPath.c_str(), ios::binary | ios::trunc),
+         m_count(0),
+         m_stringsLength(0),
+         m_finished(false) {
+      if (!m_records || !m_strings) {
+         remove(m_path.c_str());
+         remove(m_stringsPath.c_str());
+         throw std::runtime_error("could not create index " + m_path);
+      }
+      Header header;
+      memset(&header, 0, sizeof(header));
+      m_records.write(reinterpret_cast<const char*>(&header), sizeof(header));
+   }
+
+   ~Writer() {
+      remove(m_stringsPath.c_str());
+      if (!m_finished) {
+         remove(m_path.c_str());
+      }
+   }
+
+   void add(const BB_Object& object) {
+      Record record;
+      memset(&record, 0, sizeof(record));
+      store(object.name, record.nameOffset, record.nameLength);
+      store(object.id, record.idOffset, record.idLength);
+      // content types repeat endlessly, each is stored once
+      map<string, pair<uint64_t, uint32_t> >::const_iterator type = m_types.find(object.contentType);
+      if (type == m_types.end()) {
+         store(object.contentType, record.typeOffset, record.typeLength);
+         m_types[object.contentType] = make_pair(record.typeOffset, record.typeLength);
+      } else {
+         record.typeOffset = type->second.first;
+         record.typeLength = type->second.second;
+      }
+      record.contentLength = object.contentLength;
+      record.uploadTimestamp = object.uploadTimestamp;
+      record.flags = packSha1(object.contentSha1, record.sha1);
+      if (!record.flags) {
+         record.flags = packSha1(object.largeFileSha1, record.sha1);
+         if (record.flags) {
+            record.flags |= LARGE_FILE_SHA1;
+         }
+      }
+      record.action = ACTION_COUNT;
+      for (size_t i = 0; i < ACTION_COUNT; ++i) {
+         if (object.action == ACTIONS[i]) {
+            record.action = i;
+         }
+      }
+      m_records.write(reinterpret_cast<const char*>(&record), sizeof(record));
+      m_count++;
+   }
+
+   void finish() {
+      m_strings.close();
+      ifstream strings(m_stringsPath.c_str(), ios::binary);
+      if (m_stringsLength > 0 && !(m_records << strings.rdbuf())) {
+         throw std::runtime_error("could not write index " + m_path);
+      }
+
+      Header header;
+      memset(&header, 0, sizeof(header));
+      memcpy(header.magic, MAGIC, sizeof(MAGIC));
+      header.count = m_count;
+      header.stringsOffset = sizeof(Header) + m_count * sizeof(Record);
+      header.refreshed = static_cast<uint64_t>(time(NULL));
+      header.recordSize = sizeof(Record);
+      m_records.seekp(0);
+      m_records.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      m_records.close();
+      if (!m_records) {
+         throw std::runtime_error("could not write index " + m_path);
+      }
+      m_finished = true;
+   }
+
+   private:
+
+   void store(const string& value, uint64_t& offset, uint32_t& length) {
+      offset = m_stringsLength;
+      length = static_cast<uint32_t>(value.size());
+      m_strings.write(value.data(), value.size());
+      m_stringsLength += value.size();
+   }
+
+   const string m_path;
+   const string m_stringsPath;
+   ofstream m_records;
+   ofstream m_strings;
+   uint64_t m_count;
+   uint64_t m_stringsLength;
+   map<string, pair<uint64_t, uint32_t> > m_types;
+   bool m_finished;
+};
+
+BucketIndex::BucketIndex(const string& bucketId)
+   :  m_bucketId(bucketId),
+      m_path(Session::directory() + "/index-" + bucketId),
+      m_data(NULL),
+      m_length(0) {
+}
+
+BucketIndex::~BucketIndex() {
+   close();
+}
+
+bool BucketIndex::open() {
+   close();
+   int fd = ::open(m_path.c_str(), O_RDONLY);
+   if (fd < 0) {
+      return false;
+   }
+   struct stat st;
+   if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(Header)) {
+      void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (data != MAP_FAILED) {
+         m_data = static_cast<const char*>(data);
+         m_length = st.st_size;
+      }
+   }
+   ::close(fd);
+
+   // anything written by another layout or cut short is treated as absent
+   const Header* head = header();
+   if (head && (memcmp(head->magic, MAGIC, sizeof(MAGIC)) != 0 || head->recordSize != sizeof(Record)
+       || head->stringsOffset != sizeof(Header) + head->count * sizeof(Record) || head->stringsOffset > m_length)) {
+      close();
+   }
+   return m_data != NULL;
+}
+
+void BucketIndex::close() {
+   if (m_data) {
+      munmap(const_cast<char*>(m_data), m_length);
+   }
+   m_data = NULL;
+   m_length = 0;
+}
+
+uint64_t BucketIndex::refresh(BB& bb, const string& prefix) {
+   open();
+   Session::createDirectory();
+
+   ostringstream tmp;
+   tmp << m_path << ".tmp." << getpid();
+   uint64_t listed = 0;
+   {
+      Writer writer(tmp.str());
+      const uint64_t count = prefix.empty() ? 0 : size();
+      uint64_t index = prefix.empty() ? count : lowerBound(prefix);
+
+      BB_Object object;
+      for (uint64_t i = 0; i < index; ++i) {
+         unpack(record(i), object);
+         writer.add(object);
+      }
+
+      FileNameListing listing(bb, m_bucketId, "", 0, prefix);
+      while (listing.next(object)) {
+         writer.add(object);
+         listed++;
+      }
+
+      // skip what the listing just replaced and keep everything after it
+      while (index < count && startsWith(text(record(index)->nameOffset, record(index)->nameLength), prefix)) {
+         index++;
+      }
+      for ( ; index < count; ++index) {
+         unpack(record(index), object);
+         writer.add(object);
+      }
+      writer.finish();
+   }
+
+   close();
+   if (rename(tmp.str().c_str(), m_path.c_str())) {
+      remove(tmp.str().c_str());
+      throw std::runtime_error("could not replace index " + m_path);
+   }
+   open();
+   return listed;
+}
+
+bool BucketIndex::find(const string& name, BB_Object& object) const {
+   const uint64_t index = lowerBound(name);
+   if (index < size() && compare(record(index), name) == 0) {
+      unpack(record(index), object);
+      return true;
+   }
+   return false;
+}
+
+uint64_t BucketIndex::size() const {
+   const Header* head = header();
+   return head ? head->count : 0;
+}
+
+const BucketIndex::Header* BucketIndex::header() const {
+   return m_data ? reinterpret_cast<const Header*>(m_data) : NULL;
+}
+
+const BucketIndex::Record* BucketIndex::record(uint64_t index) const {
+   return reinterpret_cast<const Record*>(m_data + sizeof(Header)) + index;
+}
+
+string BucketIndex::text(uint64_t offset, uint32_t length) const {
+   const uint64_t start = header()->stringsOffset + offset;
+   if (start + length > m_length) {
+      return "";
+   }
+   return string(m_data + start, length);
+}
+
+int BucketIndex::compare(const Record* record, const string& name) const {
+   const uint64_t start = header()->stringsOffset + record->nameOffset;
+   const size_t length = start + record->nameLength > m_length ? 0 : record->nameLength;
+   // unsigned byte order, the same order B2 lists names in
+   int cmp = memcmp(m_data + start, name.data(), std::min(length, name.size()));
+   if (cmp == 0) {
+      cmp = length < name.size() ? -1 : (length > name.size() ? 1 : 0);
+   }
+   return cmp;
+}
+
+uint64_t BucketIndex::lowerBound(const string& name) const {
+   uint64_t lo = 0;
+   uint64_t hi = size();
+   while (lo < hi) {
+      const uint64_t mid = lo + (hi - lo) / 2;
+      if (compare(record(mid), name) < 0) {
+         lo = mid + 1;
+      } else {
+         hi = mid;
+      }
+   }
+   return lo;
+}
+
+void BucketIndex::unpack(const Record* record, BB_Object& object) const {
+   object.name = text(record->nameOffset, record->nameLength);
+   object.id = text(record->idOffset, record->idLength);
+   object.contentType = text(record->typeOffset, record->typeLength);
+   object.contentLength = record->contentLength;
+   object.uploadTimestamp = record->uploadTimestamp;
+   object.contentSha1.clear();
+   object.largeFileSha1.clear();
+   if (record->flags & HAS_SHA1) {
+      string sha1 = encodeHex(record->sha1, sizeof(record->sha1));
+      if (record->flags & UNVERIFIED_SHA1) {
+         sha1 = UNVERIFIED + sha1;
+      }
+      if (record->flags & LARGE_FILE_SHA1) {
+         object.contentSha1 = "none";
+         object.largeFileSha1 = sha1;
+      } else {
+         object.contentSha1 = sha1;
+      }
+   }
+   object.action = record->action < ACTION_COUNT ? ACTIONS[record->action] : "";
+}
+
+} // namespace khi
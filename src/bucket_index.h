@@ -0,0 +1,103 @@
+// vim:set et ts=3 sw=3:
+// __  __ ______ _______ _______ _______ ______ 
+// |  |/  |   __ \   |   |     __|    ___|   __ \
+// |     <|      <   |   |    |  |    ___|      <
+// |__|\__|___|__|_______|_______|_______|___|__|
+//        H E A V Y  I N D U S T R I E S
+//
+// Copyright (C) 2024 Kruger Heavy Industries
+// http://www.krugerheavyindustries.com
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty.  In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#ifndef BUCKET_INDEX_H
+#define BUCKET_INDEX_H
+
+#include <string>
+#include <stdint.h>
+
+#include "bb.h"
+
+namespace khi {
+
+// A local copy of a bucket's file names, kept next to the session file as
+// a sorted array of fixed size records followed by the strings they point
+// into. The file is mapped rather than read, so a lookup is a binary search
+// over pages the kernel brings in as needed and costs no round trip.
+//
+//    header | record 0 .. record count-1 | strings
+//
+// Records are in B2's name order and in host byte order, the index being a
+// cache for this machine only. A refresh writes a new file next to the old
+// one and renames it into place, so readers never see a partial index.
+class BucketIndex {
+
+   public:
+
+   explicit BucketIndex(const std::string& bucketId);
+
+   ~BucketIndex();
+
+   // map the index, false when there is none yet or it is not usable
+   bool open();
+
+   void close();
+
+   // re-list the names starting with prefix, every name when it is empty,
+   // and splice them in place of what the index held for that range. The
+   // rest of the index is carried over as it is, changes outside prefix are
+   // not looked for. Returns the names listed.
+   uint64_t refresh(BB& bb, const std::string& prefix = "");
+
+   bool find(const std::string& name, BB_Object& object) const;
+
+   uint64_t size() const;
+
+   inline const std::string& path() const {
+      return m_path;
+   }
+
+   private:
+
+   BucketIndex(const BucketIndex&); // prevent copy
+   BucketIndex& operator=(const BucketIndex&); // prevent assign
+
+   struct Header;
+   struct Record;
+   class Writer;
+
+   const Header* header() const;
+
+   const Record* record(uint64_t index) const;
+
+   std::string text(uint64_t offset, uint32_t length) const;
+
+   int compare(const Record* record, const std::string& name) const;
+
+   // first record whose name is not below name
+   uint64_t lowerBound(const std::string& name) const;
+
+   void unpack(const Record* record, BB_Object& object) const;
+
+   const std::string m_bucketId;
+   const std::string m_path;
+   const char* m_data;
+   size_t m_length;
+};
+
+} // namespace khi
+#endif // BUCKET_INDEX_H
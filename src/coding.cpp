@@ -139,6 +139,66 @@ size_t computeSha1UsingRange(uint8_t sha1[EVP_MAX_MD_SIZE], std::istream& stream
    return length;
 }
 
+std::string encodeHex(const uint8_t* data, size_t dataLen) {
+   std::string hex;
+   hex.reserve(dataLen * 2);
+   for (size_t j = 0; j < dataLen; ++j) {
+      hex += hexchars[(data[j] >> 4) & 0x0F];
+      hex += hexchars[data[j] & 0x0F];
+   }
+   return hex;
+}
+
+namespace {
+
+   int hexValue(char c) {
+      if (c >= '0' && c <= '9') {
+         return c - '0';
+      }
+      if (c >= 'a' && c <= 'f') {
+         return c - 'a' + 10;
+      }
+      if (c >= 'A' && c <= 'F') {
+         return c - 'A' + 10;
+      }
+      return -1;
+   }
+}
+
+bool decodeHex(const std::string& hex, uint8_t* data, size_t dataLen) {
+   if (hex.size() != dataLen * 2) {
+      return false;
+   }
+   for (size_t j = 0; j < dataLen; ++j) {
+      int high = hexValue(hex[2 * j]);
+      int low = hexValue(hex[2 * j + 1]);
+      if (high < 0 || low < 0) {
+         return false;
+      }
+      data[j] = static_cast<uint8_t>((high << 4) | low);
+   }
+   return true;
+}
+
+Sha1Digest::Sha1Digest() : m_ctx(EVP_MD_CTX_new()) {
+   EVP_DigestInit(m_ctx, EVP_sha1());
+}
+
+Sha1Digest::~Sha1Digest() {
+   EVP_MD_CTX_free(m_ctx);
+}
+
+void Sha1Digest::update(const void* data, size_t length) {
+   EVP_DigestUpdate(m_ctx, data, length);
+}
+
+std::string Sha1Digest::hex() {
+   uint8_t sha1[EVP_MAX_MD_SIZE];
+   unsigned int length;
+   EVP_DigestFinal_ex(m_ctx, sha1, &length);
+   return encodeHex(sha1, length);
+}
+
 string computeSHA1(std::istream& fin) { 
    uint8_t sha1[EVP_MAX_MD_SIZE];
    computeSha1(sha1, fin);
@@ -36,6 +36,10 @@
 #include <openssl/bio.h>
 
 std::string encodeB64(uint8_t * data, size_t dataLen);
+std::string encodeHex(const uint8_t* data, size_t dataLen);
+
+// false unless hex is exactly dataLen bytes' worth of hex digits
+bool decodeHex(const std::string& hex, uint8_t* data, size_t dataLen);
 
 size_t computeSha1(uint8_t sha1[EVP_MAX_MD_SIZE], std::istream& istrm);
 size_t computeSha1(std::istream& fin);
@@ -45,4 +49,25 @@ size_t computeSha1UsingRange(uint8_t sha1[EVP_MAX_MD_SIZE], std::istream& istrm,
 size_t computeMD5(uint8_t md5[EVP_MAX_MD_SIZE], std::istream& istrm);
 std::string computeMD5(std::istream & istrm);
 
+// Incremental SHA1 for data that is only ever seen a chunk at a time
+class Sha1Digest {
+
+   public:
+
+   Sha1Digest();
+   ~Sha1Digest();
+
+   void update(const void* data, size_t length);
+
+   // finalizes the digest, further updates are not allowed
+   std::string hex();
+
+   private:
+
+   Sha1Digest(const Sha1Digest&); // prevent copy
+   Sha1Digest& operator=(const Sha1Digest&); // prevent assign
+
+   EVP_MD_CTX* m_ctx;
+};
+
 #endif // CODING_H
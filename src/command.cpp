@@ -40,11 +40,10 @@ using namespace std;
 void Base::printBucket(const BB_Bucket& bucket, bool bucketName) const { 
    if (bucketName)
       cout << bucket.name << " (" << bucket.id << ")" << endl;
-   list<BB_Object>::const_iterator obj;
+   ObjectList::const_iterator obj;
    for (obj = bucket.objects.begin(); obj != bucket.objects.end(); ++obj) {
        if (bucketName) cout << "  ";
        printObject(*obj);
-       cout << endl;
    }
 }
 
@@ -37,6 +37,7 @@ class CommandLine;
 namespace khi {
 class BB_Bucket;
 class BB_Object; 
+class ObjectList;
 class BB;
 }
 
@@ -139,6 +140,8 @@ struct Dispatcher : public std::map<std::string, Base*> {
 #include "command_delete_bucket.h"
 #include "command_update_bucket.h"
 #include "command_list_buckets.h"
+#include "command_index_bucket.h"
+#include "command_lookup_file.h"
 
 #endif // COMMAND_H
 
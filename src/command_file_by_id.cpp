@@ -44,12 +44,16 @@ int FileById::execute(size_t wordc, CommandLine& cmds, BB& bb) {
    string localFilePath;
 
    parse2(idx, cmds, fileId, localFilePath);
-   return bb.downloadFileById(fileId, localFilePath.empty() ? fileId.c_str() : localFilePath.c_str());
+   int numThreads = cmds.opts.exists("-n") ? cmds.opts.getWithDefault("-n", 0) : 0;
+
+   return bb.downloadFileById(fileId, localFilePath.empty() ? fileId.c_str() : localFilePath.c_str(), numThreads);
 }
 
 void FileById::printUsage() { 
    cout << "Download file from backblaze:" << endl;
-   cout << "\tblazer download_file_by_id <fileId> <localFilePath>" << endl;
+   cout << "\tblazer download_file_by_id [-n <numThreads>] <fileId> <localFilePath>" << endl;
+   cout << "\t-n defaults to a few threads, scaled down for small files; -d 2 shows the chosen ranges" << endl;
+   cout << "\ta localFilePath of - writes the file to stdout, in order, for piping into other tools" << endl;
    cout << endl;
 }
 
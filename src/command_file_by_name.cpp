@@ -46,15 +46,15 @@ int FileByName::execute(size_t wordc, CommandLine& cmds, BB& bb) {
    parse2(idx, cmds, bucketName, remoteFileName);
 
    string localFilePath = cmds.words[idx];
-   ofstream fout(localFilePath.c_str(), ios_base::binary | ios_base::out);
-   bb.downloadFileByName(bucketName, remoteFileName, fout);
+   int numThreads = cmds.opts.exists("-n") ? cmds.opts.getWithDefault("-n", 0) : 0;
 
-   return EXIT_SUCCESS;
+   return bb.downloadFileByName(bucketName, remoteFileName, localFilePath, numThreads);
 }
 
 void FileByName::printUsage() { 
    cout << "Download file from backblaze:" << endl;
-   cout << "\tblazer download_file_by_name <bucketName> <remoteFileName> <localFilePath>" << endl;
+   cout << "\tblazer download_file_by_name [-n <numThreads>] <bucketName> <remoteFileName> <localFilePath>" << endl;
+   cout << "\ta localFilePath of - writes the file to stdout, in order, for piping into other tools" << endl;
    cout << endl;
 }
 
@@ -27,6 +27,7 @@
 #include "command_list_buckets.h"
 
 #include "bb.h"
+#include "commandline.h"
 
 namespace khi {
 namespace command {
@@ -42,16 +43,24 @@ int ListBuckets::execute(size_t wordc, CommandLine& cmds, BB& bb) {
 
 void ListBuckets::printUsage() { 
     std::cout << "List all buckets:" << std::endl;
-    std::cout << "\tblazer list_buckets" << std::endl;
+    std::cout << "\tblazer list_buckets [-l] [-n <numThreads>]" << std::endl;
+    std::cout << "\t-l lists the files in each bucket too, -n of the buckets at once (default 4)" << std::endl;
     std::cout << std::endl;
 }
 
 void ListBuckets::listBuckets(CommandLine& cmds, BB& bb) { 
-   std::list<BB_Bucket>& buckets = bb.getBuckets(false, true);
+   const bool contents = cmds.hasFlag("-l");
+   if (cmds.opts.exists("-n")) {
+      bb.setBucketThreads(cmds.opts.getWithDefault("-n", 1));
+   }
+   std::list<BB_Bucket>& buckets = bb.getBuckets(contents, true);
    std::list<BB_Bucket>::iterator bkt;
 
    for (bkt = buckets.begin(); bkt != buckets.end(); ++bkt) {
       std::cout << bkt->id << " " << bkt->type << " " << bkt->name << std::endl;
+      if (contents) {
+         printBucket(*bkt);
+      }
    }
 }
 } // namespace command 
@@ -47,26 +47,30 @@ int ListFileVersions::execute(size_t wordc, CommandLine& cmds, BB& bb) {
 
 void ListFileVersions::printUsage() { 
    cout << "Lists all the versions of all files contained in one bucket:" << endl;
-   cout << "\tblazer list_file_versions <bucketName>" << endl;
+   cout << "\tblazer list_file_versions [-p <prefix>] [-D <delimiter>] <bucketName> [<startFileName> [<startFileId> [<maxFileCount>]]]" << endl;
    cout << endl;
 }
 
-const list<BB_Object> ListFileVersions::select(size_t wordc, CommandLine& cmds, BB& bb) { 
+const ObjectList ListFileVersions::select(size_t wordc, CommandLine& cmds, BB& bb) { 
+   const string prefix = cmds.opts.getWithDefault("-p", "");
+   const string delimiter = cmds.opts.getWithDefault("-D", "");
+   // the api wants the bucket id, the command line takes the name
+   const string bucketId = bb.getBucket(cmds.words[1]).id;
    switch (wordc) { 
       case 2:
-         return bb.listFileVersions(cmds.words[1]);
+         return bb.listFileVersions(bucketId, "", "", 0, prefix, delimiter);
       case 3:
-         return bb.listFileVersions(cmds.words[1], cmds.words[2]);
+         return bb.listFileVersions(bucketId, cmds.words[2], "", 0, prefix, delimiter);
       case 4: 
-         return bb.listFileVersions(cmds.words[1], cmds.words[2], cmds.words[3]);
+         return bb.listFileVersions(bucketId, cmds.words[2], cmds.words[3], 0, prefix, delimiter);
       case 5:
-         return bb.listFileVersions(cmds.words[1], cmds.words[2], cmds.words[3], maxFileCount(cmds.words[4]));
+         return bb.listFileVersions(bucketId, cmds.words[2], cmds.words[3], maxFileCount(cmds.words[4]), prefix, delimiter);
    }
-   return list<BB_Object>();
+   return ObjectList();
 }
 
-int ListFileVersions::listFiles(const list<BB_Object>& objects) { 
-   list<BB_Object>::const_iterator iter = objects.begin();
+int ListFileVersions::listFiles(const ObjectList& objects) { 
+   ObjectList::const_iterator iter = objects.begin();
    for ( ; iter != objects.end(); ++iter) {
       printObject(*iter, true);
    }
@@ -29,8 +29,6 @@
 
 #include "command.h"
 
-#include <list> 
-
 namespace khi { 
 namespace command { 
 
@@ -44,9 +42,9 @@ struct ListFileVersions : Base {
 
    private: 
 
-   const std::list<BB_Object> select(size_t wordc, CommandLine& cmds, BB& bb);
+   const ObjectList select(size_t wordc, CommandLine& cmds, BB& bb);
 
-   int listFiles(const std::list<BB_Object>& objects);
+   int listFiles(const ObjectList& objects);
 
    int maxFileCount(const std::string& str);
 };
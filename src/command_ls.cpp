@@ -29,8 +29,10 @@
 #include <ostream>
 #include <algorithm>
 #include <functional>
+#include <memory>
 
 #include "bb.h"
+#include "listing.h"
 #include "commandline.h"
 
 namespace khi { 
@@ -50,7 +52,10 @@ int Ls::execute(size_t wordc, CommandLine& cmds, BB& bb) {
 
 void Ls::printUsage() { 
     std::cout << "List bucket contents:" << std::endl;
-    std::cout << "\tblazer ls <bucketName> [<startFileName>] [<maxFileCount>]" << std::endl;
+    std::cout << "\tblazer ls [-n <numThreads>] [-p <prefix>] [-D <delimiter>] <bucketName> [<startFileName>] [<maxFileCount>]" << std::endl;
+    std::cout << "\tlists the whole bucket unless maxFileCount is given; -p limits it to names" << std::endl;
+    std::cout << "\tstarting with prefix, -D / shows what lies below the prefix as folders;" << std::endl;
+    std::cout << "\t-n splits the names into ranges listed in parallel, still printed in order" << std::endl;
     std::cout << std::endl;
 }
 
@@ -62,8 +67,28 @@ void Ls::listBucket(CommandLine& cmds, BB& bb) {
 
    parse3(idx, cmds, bucketName, startFileName, maxFileCount);
 
-   list<BB_Object> files = bb.listBucket(bucketName, startFileName, parseOrDefault(maxFileCount, 100));
-   std::for_each(files.begin(), files.end(), PrintObject(*this)); 
+   // entries are printed as their page arrives, the whole bucket is never
+   // held in memory. maxFileCount caps the total, by default there is none
+   const string prefix = cmds.opts.getWithDefault("-p", "");
+   const string delimiter = cmds.opts.getWithDefault("-D", "");
+   const int numThreads = cmds.opts.getWithDefault("-n", 1);
+   const uint64_t limit = parseOrDefault(maxFileCount, 0);
+   const string bucketId = bb.getBucket(bucketName).id;
+
+   // folders only make sense to a single cursor walking the names in order
+   std::unique_ptr<Listing> listing;
+   if (numThreads > 1 && delimiter.empty()) {
+      listing.reset(new PartitionedListing(bb, bucketId, numThreads, startFileName, prefix, limit));
+   } else {
+      listing.reset(new FileNameListing(bb, bucketId, startFileName, limit, prefix, delimiter));
+   }
+
+   uint64_t count = 0;
+   BB_Object object;
+   while ((limit == 0 || count < limit) && listing->next(object)) {
+      printObject(object);
+      count++;
+   }
 }
 
 } // namespace command
@@ -26,7 +26,7 @@
 
 #include "command_upload_file.h"
 
-#include <ostream>
+#include <iostream>
 
 #include "commandline.h"
 #include "mimetypes.h"
@@ -52,13 +52,24 @@ int UploadFile::execute(size_t wordc, CommandLine& cmds, BB& bb) {
    string contentType = cmds.opts.exists("-t") ? cmds.opts.getWithDefault("-t", "") : MimeTypes::matchByExtension(localFilePath);
    int numThreads = cmds.opts.exists("-n") ? cmds.opts.getWithDefault("-n", 1) : 1;
 
+   long splitBytes = cmds.opts.getWithDefault("-s", 0L);
+   if (cmds.opts.exists("-s") && splitBytes <= 0) {
+      cerr << "splitBytes must be greater than 0" << endl;
+      printUsage();
+      return EXIT_FAILURE;
+   }
+
+   bb.setBufferedUploads(cmds.hasFlag("-b"));
+   bb.setSplitThreshold(splitBytes);
    bb.uploadFile(bucketName, localFilePath, remoteFileName, contentType, numThreads);
    return EXIT_SUCCESS;
 }
 
 void UploadFile::printUsage() { 
    cout << "Upload file to backblaze:" << endl;
-   cout << "\tblazer upload_file [-t <contentType>] [-n <numThreads>] <bucketName> <localFilePath> <remoteFileName>" << endl;
+   cout << "\tblazer upload_file [-t <contentType>] [-n <numThreads>] [-s <splitBytes>] [-b] <bucketName> <localFilePath> <remoteFileName>" << endl;
+   cout << "\t-s uploads files of at least splitBytes in parallel parts (default from measured upload speed with -n, else 200 MB)" << endl;
+   cout << "\t-b reads each part into memory once and sends retries from there (uses one part of memory per thread)" << endl;
    cout << endl;
 }
 
@@ -50,7 +50,8 @@ struct CommandLine {
    void parse(int argc, char* argv[]) {
       int j = 0;
       while (j < argc) {
-         if (argv[j][0] == '-') {
+         // a lone - is a word, conventionally standing for stdin or stdout
+         if (argv[j][0] == '-' && argv[j][1] != '\0') {
             std::string flag = std::string(argv[j], 0, 2);
             std::set<std::string>::iterator match = flags.find(flag);
             if (match != flags.end()) {
@@ -28,9 +28,12 @@
 
 #include <cstdlib>
 #include <cassert>
+#include <cstdint>
 
 #include <algorithm>
 
+#include <sched.h>
+
 namespace khi {
 
 struct AllExitSuccess
@@ -38,12 +41,20 @@ struct AllExitSuccess
    bool operator() (const int c) const { return c == EXIT_SUCCESS; }
 };
 
-Dispatcho::Dispatcho(int numThreads) { 
-   m_numThreads = numThreads; 
+const int Dispatcho::SPINS_BEFORE_PARKING = 16;
+
+thread_local Dispatcho::Worker* Dispatcho::s_current = NULL;
+
+Dispatcho::Dispatcho(int numThreads) 
+   :  m_running(true),
+      m_drain(false),
+      m_joined(false),
+      m_numThreads(std::max(1, numThreads)),
+      m_next(0),
+      m_pending(0),
+      m_sleeping(0) {
    m_results = new int[m_numThreads]();
    createThreads();
-   m_running = true;
-   m_drain = false;
 }
 
 Dispatcho::~Dispatcho() { 
@@ -53,51 +64,75 @@ Dispatcho::~Dispatcho() {
 int Dispatcho::createThreads() {
    pthread_mutex_init(&m_mutex, NULL);
    pthread_cond_init(&m_condition, NULL);
-   m_threads = new pthread_t[m_numThreads];
+   m_workers = new Worker[m_numThreads];
+   for (int i = 0; i < m_numThreads; ++i) { 
+      m_workers[i].pool = this;
+      m_workers[i].index = i;
+      pthread_mutex_init(&m_workers[i].mutex, NULL);
+   }
+   // every deque exists before any thread can go looking for work to steal
    for (int i = 0; i < m_numThreads; ++i) { 
-      pthread_create(&m_threads[i], NULL, threadMain, this);
+      pthread_create(&m_workers[i].thread, NULL, threadMain, &m_workers[i]);
    }
    return 0;
 }
 
 int Dispatcho::async(Task* task) { 
-   pthread_mutex_lock(&m_mutex);
-   m_queue.push_back(task);
-   int size = m_queue.size();
-   pthread_mutex_unlock(&m_mutex);
-   pthread_cond_signal(&m_condition);
+   // a task queued from inside the pool stays with the worker that queued
+   // it and runs next, anything else is dealt out round robin
+   Worker* worker = s_current;
+   const bool local = worker != NULL && worker->pool == this;
+   if (!local) {
+      worker = &m_workers[m_next++ % m_numThreads];
+   }
+   // counted before it is queued so a parking worker can never miss it
+   int size = ++m_pending;
+   pthread_mutex_lock(&worker->mutex);
+   if (local) {
+      worker->tasks.push_front(task);
+   } else {
+      worker->tasks.push_back(task);
+   }
+   pthread_mutex_unlock(&worker->mutex);
+
+   if (m_sleeping > 0) {
+      pthread_mutex_lock(&m_mutex);
+      pthread_cond_signal(&m_condition);
+      pthread_mutex_unlock(&m_mutex);
+   }
    return size; 
 }
 
 int Dispatcho::workoff() {
-   int ret = EXIT_SUCCESS;
    if (!m_running) { 
       return EXIT_FAILURE;
    }
+   pthread_mutex_lock(&m_mutex);
    m_drain = true;
    pthread_cond_broadcast(&m_condition);
+   pthread_mutex_unlock(&m_mutex);
 
-   for (int i = 0; i < m_numThreads; i++) {
-      pthread_join(m_threads[i], reinterpret_cast<void**>(&m_results[i]));
-   }
-
-   ret = std::all_of(m_results, m_results + m_numThreads, AllExitSuccess()) ? EXIT_SUCCESS : EXIT_FAILURE;
-
-   return ret;
+   return join();
 }
 
 int Dispatcho::stop() {
-   int ret = EXIT_SUCCESS;
    if (!m_running) {
       return EXIT_FAILURE;
    }
+   pthread_mutex_lock(&m_mutex);
    m_running = false;
    pthread_cond_broadcast(&m_condition);
+   pthread_mutex_unlock(&m_mutex);
 
-   ret = std::all_of(m_results, m_results + m_numThreads, AllExitSuccess()) ? EXIT_SUCCESS : EXIT_FAILURE;
+   // workers finish the task in hand before they notice, and their deques
+   // have to outlive them
+   int ret = join();
 
+   for (int i = 0; i < m_numThreads; ++i) {
+      pthread_mutex_destroy(&m_workers[i].mutex);
+   }
    delete [] m_results;
-   delete [] m_threads;
+   delete [] m_workers;
    pthread_mutex_destroy(&m_mutex);
    pthread_cond_destroy(&m_condition);
 
@@ -105,48 +140,96 @@ int Dispatcho::stop() {
 }
 
 int Dispatcho::size() {
-   pthread_mutex_lock(&m_mutex);
-   int size = m_queue.size();
-   pthread_mutex_unlock(&m_mutex);
-   return size;
+   return m_pending;
+}
+
+int Dispatcho::join() {
+   if (!m_joined) {
+      for (int i = 0; i < m_numThreads; i++) {
+         void* result = NULL;
+         pthread_join(m_workers[i].thread, &result);
+         m_results[i] = static_cast<int>(reinterpret_cast<intptr_t>(result));
+      }
+      m_joined = true;
+   }
+   return std::all_of(m_results, m_results + m_numThreads, AllExitSuccess()) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-Task* Dispatcho::take() {
+Task* Dispatcho::take(Worker& worker) {
    Task* task = NULL;
-   if (m_queue.empty() && m_drain)
-      return task;
-   if (m_running) {
-      while (m_queue.empty()) {
-          pthread_mutex_lock(&m_mutex);
-          pthread_cond_wait(&m_condition, &m_mutex);
-          pthread_mutex_unlock(&m_mutex);
+   pthread_mutex_lock(&worker.mutex);
+   if (!worker.tasks.empty()) {
+      task = worker.tasks.front();
+      worker.tasks.pop_front();
+      --m_pending;
+   }
+   pthread_mutex_unlock(&worker.mutex);
+   return task ? task : steal(worker);
+}
+
+Task* Dispatcho::steal(Worker& thief) {
+   // victims are visited starting from the next worker along so thieves
+   // spread out rather than all queueing on the first deque
+   for (int i = 1; i < m_numThreads; ++i) {
+      Worker& victim = m_workers[(thief.index + i) % m_numThreads];
+      Task* task = NULL;
+      pthread_mutex_lock(&victim.mutex);
+      if (!victim.tasks.empty()) {
+         task = victim.tasks.back();
+         victim.tasks.pop_back();
+         --m_pending;
       }
-      assert(!m_queue.empty());
-      pthread_mutex_lock(&m_mutex);
-      task = m_queue.front();
-      m_queue.pop_front();
-      pthread_mutex_unlock(&m_mutex);
+      pthread_mutex_unlock(&victim.mutex);
+      if (task) {
+         return task;
+      }
+   }
+   return NULL;
+}
+
+bool Dispatcho::park() {
+   pthread_mutex_lock(&m_mutex);
+   // announced before m_pending is looked at, async() bumps m_pending before
+   // it looks at m_sleeping, so one of the two always sees the other
+   ++m_sleeping;
+   while (m_running && !m_drain && m_pending == 0) {
+      pthread_cond_wait(&m_condition, &m_mutex);
    }
-   return task;
+   --m_sleeping;
+   // idle workers have to notice a drain too, otherwise a pool with more
+   // threads than tasks never lets workoff() join them
+   bool more = m_running && m_pending > 0;
+   pthread_mutex_unlock(&m_mutex);
+   return more;
 }
 
 void* Dispatcho::threadMain(void* arg) {
   int ret = EXIT_SUCCESS;
-  pthread_t tid = pthread_self();
-  Dispatcho* dispatcho = static_cast<Dispatcho*>(arg);
+  Worker* worker = static_cast<Worker*>(arg);
+  Dispatcho* dispatcho = worker->pool;
+  s_current = worker;
   while (dispatcho->m_running && ret == EXIT_SUCCESS) {
-      Task* task = dispatcho->take();
+      Task* task = dispatcho->take(*worker);
+      // a worker that has just run dry yields a few times before parking,
+      // tasks tend to arrive in bursts and a wakeup costs far more
+      for (int spin = 0; task == NULL && spin < SPINS_BEFORE_PARKING; ++spin) {
+         sched_yield();
+         task = dispatcho->take(*worker);
+      }
       if (task == NULL) {
-          break;
+         if (!dispatcho->park()) {
+            break;
+         }
+         continue;
       }
-      assert(task);
       try {
          ret = task->run();
       } catch (...) {
          ret = EXIT_FAILURE;
       }
   }
-  pthread_exit(reinterpret_cast<void*>(ret));
+  s_current = NULL;
+  pthread_exit(reinterpret_cast<void*>(static_cast<intptr_t>(ret)));
 }
 
 } // namespace khi
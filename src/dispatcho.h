@@ -27,6 +27,7 @@
 #ifndef DISPATCHO_H
 #define DISPATCHO_H
 
+#include <atomic>
 #include <deque>
 #include <string>
 #include <pthread.h>
@@ -58,6 +59,9 @@ protected:
 
 };
 
+// Each worker owns a deque: it takes from the front of its own and, when that
+// runs dry, steals from the back of the others. Idle workers park on a
+// condition variable and are only woken when there is something to run.
 class Dispatcho {
 
 public:
@@ -75,23 +79,45 @@ public:
 
 private:
 
+   struct Worker {
+      Dispatcho* pool;
+      int index;
+      pthread_t thread;
+      pthread_mutex_t mutex;
+      std::deque<Task*> tasks;
+   };
+
    Dispatcho& operator=(const Dispatcho&); // prevent assign
    Dispatcho(const Dispatcho&); // prevent copy
 
    int createThreads();
 
-   Task* take();
+   int join();
+
+   Task* take(Worker& worker);
+
+   Task* steal(Worker& thief);
+
+   bool park();
 
    static void* threadMain(void* threadData);
 
-   volatile bool m_running;
-   volatile bool m_drain;
+   static const int SPINS_BEFORE_PARKING;
+
+   static thread_local Worker* s_current;
+
+   std::atomic<bool> m_running;
+   std::atomic<bool> m_drain;
+   bool m_joined;
 
    int m_numThreads; 
-   std::deque<Task*> m_queue;
+   Worker* m_workers;
+   std::atomic<unsigned> m_next;
+
+   std::atomic<int> m_pending;
+   std::atomic<int> m_sleeping;
 
    int* m_results;
-   pthread_t* m_threads;
    pthread_mutex_t m_mutex;
    pthread_cond_t  m_condition;
 };
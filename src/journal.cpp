@@ -0,0 +1,132 @@
+// vim:set et ts=3 sw=3:
+// __  __ ______ _______ _______ _______ ______ 
+// |  |/  |   __ \   |   |     __|    ___|   __ \
+// |     <|      <   |   |    |  |    ___|      <
+// |__|\__|___|__|_______|_______|_______|___|__|
+//        H E A V Y  I N D U S T R I E S
+//
+// Copyright (C) 2024 Kruger Heavy Industries
+// http://www.krugerheavyindustries.com
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty.  In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "journal.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+
+#include "coding.h"
+#include "session.h"
+
+using namespace std;
+
+namespace khi {
+
+Journal::Journal(const string& key) {
+   Sha1Digest digest;
+   digest.update(key.data(), key.size());
+   m_path = Session::directory() + "/journal-" + digest.hex();
+   pthread_mutex_init(&m_mutex, NULL);
+}
+
+Journal::~Journal() {
+   pthread_mutex_destroy(&m_mutex);
+}
+
+bool Journal::load(const string& stamp) {
+   m_fileId.clear();
+   m_ranges.clear();
+   m_entries.clear();
+
+   ifstream strm(m_path.c_str());
+   string kind;
+   string fileId;
+   string recorded;
+   if (!(strm >> kind >> fileId >> recorded) || kind != "journal") {
+      return false;
+   }
+   // remembered even when stale so the caller can tidy up after it
+   m_fileId = fileId;
+   if (recorded != stamp) {
+      return false;
+   }
+   while (strm >> kind) {
+      int index;
+      if (kind == "range") {
+         uint64_t start;
+         uint64_t end;
+         if (strm >> index >> start >> end) {
+            m_ranges.push_back(BB_Range(start, end));
+         }
+      } else if (kind == "done") {
+         string value;
+         if (strm >> index >> value) {
+            m_entries[index] = value;
+         }
+      } else {
+         break;
+      }
+   }
+   return !m_ranges.empty();
+}
+
+void Journal::begin(const string& fileId, const string& stamp, const vector<BB_Range>& ranges) {
+   m_fileId = fileId;
+   m_ranges = ranges;
+   m_entries.clear();
+
+   if (m_path.empty()) {
+      return;
+   }
+   Session::createDirectory();
+   ofstream strm(m_path.c_str(), ios_base::out | ios_base::trunc);
+   strm << "journal " << fileId << " " << stamp << endl;
+   for (size_t i = 0; i < ranges.size(); ++i) {
+      strm << "range " << i << " " << ranges[i].start << " " << ranges[i].end << endl;
+   }
+   if (!strm) {
+      // the transfer itself does not need the journal, it just cannot be
+      // resumed if it is interrupted
+      cerr << "warning: could not write journal " << m_path << ", transfer will not be resumable" << endl;
+      strm.close();
+      std::remove(m_path.c_str());
+      m_path.clear();
+   }
+}
+
+void Journal::record(int index, const string& value) {
+   pthread_mutex_lock(&m_mutex);
+   m_entries[index] = value;
+   if (!m_path.empty()) {
+      ofstream strm(m_path.c_str(), ios_base::out | ios_base::app);
+      strm << "done " << index << " " << value << endl;
+   }
+   pthread_mutex_unlock(&m_mutex);
+}
+
+void Journal::remove() {
+   if (!m_path.empty()) {
+      std::remove(m_path.c_str());
+   }
+   m_fileId.clear();
+   m_ranges.clear();
+   m_entries.clear();
+}
+
+} // namespace khi
@@ -0,0 +1,95 @@
+// vim:set et ts=3 sw=3:
+// __  __ ______ _______ _______ _______ ______ 
+// |  |/  |   __ \   |   |     __|    ___|   __ \
+// |     <|      <   |   |    |  |    ___|      <
+// |__|\__|___|__|_______|_______|_______|___|__|
+//        H E A V Y  I N D U S T R I E S
+//
+// Copyright (C) 2024 Kruger Heavy Industries
+// http://www.krugerheavyindustries.com
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty.  In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <pthread.h>
+
+#include "bb.h"
+
+namespace khi {
+
+// A small append only record of a multi part transfer, kept next to the
+// session file so an interrupted transfer can pick up where it stopped.
+//
+//    journal <fileId> <stamp>
+//    range <index> <start> <end>
+//    done <index> <value>
+//
+// The stamp identifies the content the ranges were planned for; a journal
+// whose stamp no longer matches is ignored. Later done lines for the same
+// index replace earlier ones.
+class Journal {
+
+   public:
+
+   explicit Journal(const std::string& key);
+
+   ~Journal();
+
+   // read an existing journal, true when there is one for this stamp. The
+   // fileId of a stale journal is still made available through fileId().
+   bool load(const std::string& stamp);
+
+   // start a fresh journal, discarding anything recorded before. A journal
+   // that cannot be written is reported and the transfer goes on without it.
+   void begin(const std::string& fileId, const std::string& stamp, const std::vector<BB_Range>& ranges);
+
+   // safe to call from several worker threads at once
+   void record(int index, const std::string& value);
+
+   void remove();
+
+   inline const std::string& fileId() const {
+      return m_fileId;
+   }
+
+   inline const std::vector<BB_Range>& ranges() const {
+      return m_ranges;
+   }
+
+   inline const std::map<int, std::string>& entries() const {
+      return m_entries;
+   }
+
+   private:
+
+   Journal(const Journal&); // prevent copy
+   Journal& operator=(const Journal&); // prevent assign
+
+   std::string m_path;
+   std::string m_fileId;
+   std::vector<BB_Range> m_ranges;
+   std::map<int, std::string> m_entries;
+   pthread_mutex_t m_mutex;
+};
+
+} // namespace khi
+#endif // JOURNAL_H
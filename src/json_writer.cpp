@@ -0,0 +1,139 @@
+// vim:set et ts=3 sw=3:
+// __  __ ______ _______ _______ _______ ______ 
+// |  |/  |   __ \   |   |     __|    ___|   __ \
+// |     <|      <   |   |    |  |    ___|      <
+// |__|\__|___|__|_______|_______|_______|___|__|
+//        H E A V Y  I N D U S T R I E S
+//
+// Copyright (C) 2024 Kruger Heavy Industries
+// http://www.krugerheavyindustries.com
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty.  In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "json_writer.h"
+
+#include <cstdio>
+#include <stdexcept>
+
+using namespace std;
+
+namespace khi {
+
+JsonWriter::JsonWriter(string& buffer)
+   :  m_buffer(buffer),
+      m_depth(0) {
+   m_buffer.clear();
+   m_first[0] = true;
+}
+
+JsonWriter& JsonWriter::begin() {
+   separate();
+   m_buffer += '{';
+   if (++m_depth >= MAX_DEPTH) {
+      throw std::logic_error("json nested too deeply");
+   }
+   m_first[m_depth] = true;
+   return *this;
+}
+
+JsonWriter& JsonWriter::end() {
+   m_buffer += '}';
+   m_depth--;
+   return *this;
+}
+
+JsonWriter& JsonWriter::beginArray(const char* name) {
+   key(name);
+   m_buffer += '[';
+   if (++m_depth >= MAX_DEPTH) {
+      throw std::logic_error("json nested too deeply");
+   }
+   m_first[m_depth] = true;
+   return *this;
+}
+
+JsonWriter& JsonWriter::endArray() {
+   m_buffer += ']';
+   m_depth--;
+   return *this;
+}
+
+JsonWriter& JsonWriter::field(const char* name, const string& value) {
+   key(name);
+   quote(value);
+   return *this;
+}
+
+JsonWriter& JsonWriter::field(const char* name, int64_t value) {
+   key(name);
+   char digits[24];
+   int length = snprintf(digits, sizeof(digits), "%lld", static_cast<long long>(value));
+   m_buffer.append(digits, length);
+   return *this;
+}
+
+JsonWriter& JsonWriter::value(const string& value) {
+   separate();
+   quote(value);
+   return *this;
+}
+
+void JsonWriter::separate() {
+   if (!m_first[m_depth]) {
+      m_buffer += ',';
+   }
+   m_first[m_depth] = false;
+}
+
+void JsonWriter::key(const char* name) {
+   separate();
+   m_buffer += '"';
+   m_buffer += name; // keys are literals that never need escaping
+   m_buffer += "\":";
+}
+
+void JsonWriter::quote(const string& value) {
+   static const char hex[] = "0123456789abcdef";
+   m_buffer += '"';
+   // runs that need no escaping, which is nearly everything, go in whole
+   string::const_iterator start = value.begin();
+   for (string::const_iterator iter = value.begin(); iter != value.end(); ++iter) {
+      const unsigned char c = static_cast<unsigned char>(*iter);
+      if (c >= 0x20 && c != '"' && c != '\\') {
+         continue;
+      }
+      m_buffer.append(start, iter);
+      start = iter + 1;
+      switch (c) {
+         case '"': m_buffer += "\\\""; break;
+         case '\\': m_buffer += "\\\\"; break;
+         case '\b': m_buffer += "\\b"; break;
+         case '\f': m_buffer += "\\f"; break;
+         case '\n': m_buffer += "\\n"; break;
+         case '\r': m_buffer += "\\r"; break;
+         case '\t': m_buffer += "\\t"; break;
+         default:
+            m_buffer += "\\u00";
+            m_buffer += hex[c >> 4];
+            m_buffer += hex[c & 0x0f];
+      }
+   }
+   m_buffer.append(start, value.end());
+   m_buffer += '"';
+}
+
+} // namespace khi
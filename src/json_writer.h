@@ -0,0 +1,88 @@
+// vim:set et ts=3 sw=3:
+// __  __ ______ _______ _______ _______ ______ 
+// |  |/  |   __ \   |   |     __|    ___|   __ \
+// |     <|      <   |   |    |  |    ___|      <
+// |__|\__|___|__|_______|_______|_______|___|__|
+//        H E A V Y  I N D U S T R I E S
+//
+// Copyright (C) 2024 Kruger Heavy Industries
+// http://www.krugerheavyindustries.com
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty.  In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <string>
+#include <stdint.h>
+
+namespace khi {
+
+// Writes a JSON request body straight into a caller supplied buffer, with
+// no document tree in between. The buffer is cleared but keeps its
+// capacity, so a buffer reused from one request to the next costs no
+// allocations at all once it has grown to the size of a typical body.
+//
+//    JsonWriter json(buffer);
+//    json.begin().field("fileId", fileId).field("maxPartCount", 1000).end();
+//
+// Nesting is limited to what B2 request bodies need.
+class JsonWriter {
+
+   public:
+
+   explicit JsonWriter(std::string& buffer);
+
+   JsonWriter& begin();
+
+   JsonWriter& end();
+
+   JsonWriter& beginArray(const char* key);
+
+   JsonWriter& endArray();
+
+   JsonWriter& field(const char* key, const std::string& value);
+
+   JsonWriter& field(const char* key, int64_t value);
+
+   // an element of the array being written
+   JsonWriter& value(const std::string& value);
+
+   inline const std::string& str() const {
+      return m_buffer;
+   }
+
+   private:
+
+   JsonWriter(const JsonWriter&); // prevent copy
+   JsonWriter& operator=(const JsonWriter&); // prevent assign
+
+   static const int MAX_DEPTH = 8;
+
+   void separate();
+
+   void key(const char* key);
+
+   void quote(const std::string& value);
+
+   std::string& m_buffer;
+   int m_depth;
+   bool m_first[MAX_DEPTH];
+};
+
+} // namespace khi
+#endif // JSON_WRITER_H
@@ -0,0 +1,328 @@
+// vim:set et ts=3 sw=3:
+// __  __ ______ _______ _______ _______ ______ 
+// |  |/  |   __ \   |   |     __|    ___|   __ \
+// |     <|      <   |   |    |  |    ___|      <
+// |__|\__|___|__|_______|_______|_______|___|__|
+//        H E A V Y  I N D U S T R I E S
+//
+// Copyright (C) 2024 Kruger Heavy Industries
+// http://www.krugerheavyindustries.com
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty.  In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "list_reader.h"
+
+#include <stdexcept>
+
+using namespace std;
+
+namespace khi {
+
+ListReader::ListReader(const char* data, size_t length)
+   :  m_pos(data),
+      m_end(data + length) {
+}
+
+void ListReader::read(Handler& handler) {
+   m_nextFileName.clear();
+   m_nextFileId.clear();
+
+   expect('{');
+   if (peek() == '}') {
+      next();
+      return;
+   }
+   do {
+      readString(m_key);
+      expect(':');
+      if (m_key == "files") {
+         readFiles(handler);
+      } else if (m_key == "nextFileName") {
+         readOptionalString(m_nextFileName);
+      } else if (m_key == "nextFileId") {
+         readOptionalString(m_nextFileId);
+      } else {
+         skipValue();
+      }
+   } while (next() == ',');
+   --m_pos;
+   expect('}');
+}
+
+void ListReader::readFiles(Handler& handler) {
+   if (peek() != '[') {
+      skipValue();
+      return;
+   }
+   next();
+   if (peek() == ']') {
+      next();
+      return;
+   }
+   do {
+      if (peek() == '{') {
+         readFile();
+         handler.file(m_object);
+      } else {
+         skipValue();
+      }
+   } while (next() == ',');
+   --m_pos;
+   expect(']');
+}
+
+void ListReader::readFile() {
+   // fields keep their capacity from the previous file
+   m_object.id.clear();
+   m_object.name.clear();
+   m_object.contentType.clear();
+   m_object.contentSha1.clear();
+   m_object.largeFileSha1.clear();
+   m_object.action.clear();
+   m_object.contentLength = 0;
+   m_object.uploadTimestamp = 0;
+
+   expect('{');
+   if (peek() == '}') {
+      next();
+      return;
+   }
+   do {
+      readString(m_key);
+      expect(':');
+      if (m_key == "fileId") {
+         readOptionalString(m_object.id);
+      } else if (m_key == "fileName") {
+         readOptionalString(m_object.name);
+      } else if (m_key == "contentType") {
+         readOptionalString(m_object.contentType);
+      } else if (m_key == "contentSha1") {
+         readOptionalString(m_object.contentSha1);
+      } else if (m_key == "action") {
+         readOptionalString(m_object.action);
+      } else if (m_key == "contentLength") {
+         m_object.contentLength = readInteger();
+      } else if (m_key == "uploadTimestamp") {
+         m_object.uploadTimestamp = readInteger();
+      } else if (m_key == "fileInfo") {
+         readFileInfo();
+      } else {
+         skipValue();
+      }
+   } while (next() == ',');
+   --m_pos;
+   expect('}');
+}
+
+void ListReader::readFileInfo() {
+   if (peek() != '{') {
+      skipValue();
+      return;
+   }
+   next();
+   if (peek() == '}') {
+      next();
+      return;
+   }
+   do {
+      readString(m_key);
+      expect(':');
+      if (m_key == "large_file_sha1") {
+         readOptionalString(m_object.largeFileSha1);
+      } else {
+         skipValue();
+      }
+   } while (next() == ',');
+   --m_pos;
+   expect('}');
+}
+
+void ListReader::readOptionalString(string& value) {
+   if (peek() == '"') {
+      readString(value);
+   } else {
+      value.clear();
+      skipValue();
+   }
+}
+
+void ListReader::readString(string& value) {
+   value.clear();
+   expect('"');
+   while (true) {
+      // copy runs of plain characters in one go
+      const char* start = m_pos;
+      while (m_pos < m_end && *m_pos != '"' && *m_pos != '\\') {
+         ++m_pos;
+      }
+      value.append(start, m_pos);
+      if (m_pos >= m_end) {
+         fail("unterminated string");
+      }
+      if (*m_pos++ == '"') {
+         return;
+      }
+      if (m_pos >= m_end) {
+         fail("unterminated escape");
+      }
+      const char escaped = *m_pos++;
+      switch (escaped) {
+         case '"': value += '"'; break;
+         case '\\': value += '\\'; break;
+         case '/': value += '/'; break;
+         case 'b': value += '\b'; break;
+         case 'f': value += '\f'; break;
+         case 'n': value += '\n'; break;
+         case 'r': value += '\r'; break;
+         case 't': value += '\t'; break;
+         case 'u': {
+            uint32_t codepoint = readHex4();
+            // names outside the basic plane arrive as surrogate pairs
+            if (codepoint >= 0xd800 && codepoint < 0xdc00 && m_end - m_pos >= 6 && m_pos[0] == '\\' && m_pos[1] == 'u') {
+               m_pos += 2;
+               const uint32_t low = readHex4();
+               if (low >= 0xdc00 && low < 0xe000) {
+                  codepoint = 0x10000 + ((codepoint - 0xd800) << 10) + (low - 0xdc00);
+               } else {
+                  appendUtf8(value, codepoint);
+                  codepoint = low;
+               }
+            }
+            appendUtf8(value, codepoint);
+            break;
+         }
+         default:
+            fail("bad escape");
+      }
+   }
+}
+
+uint64_t ListReader::readInteger() {
+   if (peek() < '0' || peek() > '9') {
+      skipValue();
+      return 0;
+   }
+   uint64_t value = 0;
+   while (m_pos < m_end && *m_pos >= '0' && *m_pos <= '9') {
+      value = value * 10 + (*m_pos++ - '0');
+   }
+   return value;
+}
+
+void ListReader::skipValue() {
+   const char c = peek();
+   if (c == '"') {
+      while (++m_pos < m_end && *m_pos != '"') {
+         if (*m_pos == '\\') {
+            ++m_pos;
+         }
+      }
+      if (m_pos >= m_end) {
+         fail("unterminated string");
+      }
+      ++m_pos;
+   } else if (c == '{' || c == '[') {
+      // nesting only has to be counted, strings may hold brackets though
+      int depth = 0;
+      do {
+         const char d = peek();
+         if (d == '"') {
+            skipValue();
+            continue;
+         }
+         if (d == '{' || d == '[') {
+            depth++;
+         } else if (d == '}' || d == ']') {
+            depth--;
+         }
+         ++m_pos;
+      } while (depth > 0);
+   } else {
+      // numbers, true, false and null run up to the next delimiter
+      while (m_pos < m_end && *m_pos != ',' && *m_pos != '}' && *m_pos != ']'
+             && *m_pos != ' ' && *m_pos != '\t' && *m_pos != '\n' && *m_pos != '\r') {
+         ++m_pos;
+      }
+   }
+}
+
+void ListReader::appendUtf8(string& value, uint32_t codepoint) {
+   if (codepoint < 0x80) {
+      value += static_cast<char>(codepoint);
+   } else if (codepoint < 0x800) {
+      value += static_cast<char>(0xc0 | (codepoint >> 6));
+      value += static_cast<char>(0x80 | (codepoint & 0x3f));
+   } else if (codepoint < 0x10000) {
+      value += static_cast<char>(0xe0 | (codepoint >> 12));
+      value += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3f));
+      value += static_cast<char>(0x80 | (codepoint & 0x3f));
+   } else {
+      value += static_cast<char>(0xf0 | (codepoint >> 18));
+      value += static_cast<char>(0x80 | ((codepoint >> 12) & 0x3f));
+      value += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3f));
+      value += static_cast<char>(0x80 | (codepoint & 0x3f));
+   }
+}
+
+uint32_t ListReader::readHex4() {
+   if (m_end - m_pos < 4) {
+      fail("short unicode escape");
+   }
+   uint32_t value = 0;
+   for (int i = 0; i < 4; ++i) {
+      const char c = *m_pos++;
+      value <<= 4;
+      if (c >= '0' && c <= '9') {
+         value |= c - '0';
+      } else if (c >= 'a' && c <= 'f') {
+         value |= c - 'a' + 10;
+      } else if (c >= 'A' && c <= 'F') {
+         value |= c - 'A' + 10;
+      } else {
+         fail("bad unicode escape");
+      }
+   }
+   return value;
+}
+
+char ListReader::next() {
+   const char c = peek();
+   ++m_pos;
+   return c;
+}
+
+char ListReader::peek() {
+   while (m_pos < m_end && (*m_pos == ' ' || *m_pos == '\t' || *m_pos == '\n' || *m_pos == '\r')) {
+      ++m_pos;
+   }
+   if (m_pos >= m_end) {
+      fail("unexpected end of response");
+   }
+   return *m_pos;
+}
+
+void ListReader::expect(char c) {
+   if (next() != c) {
+      fail("unexpected character");
+   }
+}
+
+void ListReader::fail(const char* what) {
+   throw std::runtime_error(string("could not read list response: ") + what);
+}
+
+} // namespace khi
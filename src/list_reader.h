@@ -0,0 +1,129 @@
+// vim:set et ts=3 sw=3:
+// __  __ ______ _______ _______ _______ ______ 
+// |  |/  |   __ \   |   |     __|    ___|   __ \
+// |     <|      <   |   |    |  |    ___|      <
+// |__|\__|___|__|_______|_______|_______|___|__|
+//        H E A V Y  I N D U S T R I E S
+//
+// Copyright (C) 2024 Kruger Heavy Industries
+// http://www.krugerheavyindustries.com
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty.  In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#ifndef LIST_READER_H
+#define LIST_READER_H
+
+#include <string>
+#include <stdint.h>
+
+#include "bb.h"
+
+namespace khi {
+
+// Reads the files[] of a B2 list response in one forward pass over the
+// body, filling in BB_Objects field by field as the keys go by. No document
+// tree is built: strings are decoded into buffers that are reused from one
+// file to the next, and everything not needed is skipped over unparsed.
+// Handles b2_list_file_names, b2_list_file_versions and
+// b2_list_unfinished_large_files, whose entries share a layout.
+class ListReader {
+
+   public:
+
+   // receives each file as soon as its closing brace has been read; the
+   // object is reused for the next file, so copy what has to be kept
+   class Handler {
+
+      public:
+
+      virtual ~Handler() {}
+
+      virtual void file(const BB_Object& object) = 0;
+   };
+
+   ListReader(const char* data, size_t length);
+
+   // throws std::runtime_error when the body is not well formed
+   void read(Handler& handler);
+
+   inline const std::string& nextFileName() const {
+      return m_nextFileName;
+   }
+
+   inline const std::string& nextFileId() const {
+      return m_nextFileId;
+   }
+
+   private:
+
+   ListReader(const ListReader&); // prevent copy
+   ListReader& operator=(const ListReader&); // prevent assign
+
+   void readFiles(Handler& handler);
+
+   void readFile();
+
+   void readFileInfo();
+
+   // a string, or empty for null
+   void readOptionalString(std::string& value);
+
+   void readString(std::string& value);
+
+   uint64_t readInteger();
+
+   void skipValue();
+
+   void appendUtf8(std::string& value, uint32_t codepoint);
+
+   uint32_t readHex4();
+
+   char next();
+
+   char peek();
+
+   void expect(char c);
+
+   void fail(const char* what);
+
+   const char* m_pos;
+   const char* const m_end;
+
+   BB_Object m_object;
+   std::string m_key;
+   std::string m_nextFileName;
+   std::string m_nextFileId;
+};
+
+// Collects every file into an ObjectList.
+class ListCollector : public ListReader::Handler {
+
+   public:
+
+   explicit ListCollector(ObjectList& files) : m_files(files) {}
+
+   virtual void file(const BB_Object& object) {
+      m_files.push_back(object);
+   }
+
+   private:
+
+   ObjectList& m_files;
+};
+
+} // namespace khi
+#endif // LIST_READER_H
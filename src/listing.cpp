@@ -0,0 +1,436 @@
+// vim:set et ts=3 sw=3:
+// __  __ ______ _______ _______ _______ ______ 
+// |  |/  |   __ \   |   |     __|    ___|   __ \
+// |     <|      <   |   |    |  |    ___|      <
+// |__|\__|___|__|_______|_______|_______|___|__|
+//        H E A V Y  I N D U S T R I E S
+//
+// Copyright (C) 2024 Kruger Heavy Industries
+// http://www.krugerheavyindustries.com
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty.  In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "listing.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstdlib>
+#include <set>
+
+using namespace std;
+
+namespace khi {
+
+ListPageTask::ListPageTask(BB& bb, const string& bucketId, const string& startFileName, int maxFileCount, const string& prefix, const string& delimiter)
+   :  Task(NULL, "list_page_task"),
+      m_bb(bb),
+      m_bucketId(bucketId),
+      m_startFileName(startFileName),
+      m_maxFileCount(maxFileCount),
+      m_prefix(prefix),
+      m_delimiter(delimiter),
+      m_finished(false) {
+   pthread_mutex_init(&m_mutex, NULL);
+   pthread_cond_init(&m_condition, NULL);
+}
+
+ListPageTask::~ListPageTask() {
+   pthread_mutex_destroy(&m_mutex);
+   pthread_cond_destroy(&m_condition);
+}
+
+int ListPageTask::run() {
+   ObjectList files;
+   string nextFileName;
+   // a worker that returns failure stops taking tasks, so every error is
+   // kept here and surfaces in the thread that waits for the page
+   try {
+      files = m_bb.listFileNames(m_bucketId, m_startFileName, m_maxFileCount, nextFileName, m_prefix, m_delimiter);
+   } catch(const ResponseError& err) {
+      m_failure.reset(new ResponseError(err));
+   } catch(const std::exception& e) {
+      m_error = e.what();
+      if (m_error.empty()) {
+         m_error = "listing failed";
+      }
+   }
+
+   pthread_mutex_lock(&m_mutex);
+   m_files.swap(files);
+   m_nextFileName = nextFileName;
+   m_finished = true;
+   pthread_cond_broadcast(&m_condition);
+   pthread_mutex_unlock(&m_mutex);
+   return EXIT_SUCCESS;
+}
+
+void ListPageTask::wait() {
+   pthread_mutex_lock(&m_mutex);
+   while (!m_finished) {
+      pthread_cond_wait(&m_condition, &m_mutex);
+   }
+   pthread_mutex_unlock(&m_mutex);
+
+   if (m_failure) {
+      throw ResponseError(*m_failure);
+   }
+   if (!m_error.empty()) {
+      throw std::runtime_error(m_error);
+   }
+}
+
+const int FileNameListing::MAX_PAGE_FILE_COUNT = 10000;
+
+FileNameListing::FileNameListing(BB& bb, const string& bucketId, const string& startFileName, uint64_t maxFileCount, const string& prefix, const string& delimiter)
+   :  m_bb(bb),
+      m_bucketId(bucketId),
+      m_prefix(prefix),
+      m_delimiter(delimiter),
+      m_limited(maxFileCount > 0),
+      m_remaining(maxFileCount),
+      m_position(0),
+      m_pending(NULL),
+      m_prefetcher(1) {
+   prefetch(startFileName);
+}
+
+FileNameListing::~FileNameListing() {
+   // a page still in flight has to land before its task can go
+   m_prefetcher.workoff();
+   delete m_pending;
+}
+
+bool FileNameListing::next(BB_Object& object) {
+   while (m_position == m_page.size()) {
+      if (!m_pending) {
+         return false;
+      }
+      m_pending->wait();
+      m_page.swap(m_pending->files());
+      m_position = 0;
+      const string nextFileName = m_pending->nextFileName();
+      delete m_pending;
+      m_pending = NULL;
+
+      if (m_limited) {
+         if (m_page.size() > m_remaining) {
+            m_page.truncate(m_remaining);
+         }
+         m_remaining -= m_page.size();
+      }
+      // the next page is on its way while this one is handed out
+      if (!nextFileName.empty() && (!m_limited || m_remaining > 0)) {
+         prefetch(nextFileName);
+      }
+   }
+   object = m_page.at(m_position++);
+   return true;
+}
+
+void FileNameListing::prefetch(const string& startFileName) {
+   int count = MAX_PAGE_FILE_COUNT;
+   if (m_limited) {
+      count = static_cast<int>(std::min(m_remaining, static_cast<uint64_t>(MAX_PAGE_FILE_COUNT)));
+   }
+   m_pending = new ListPageTask(m_bb, m_bucketId, startFileName, count, m_prefix, m_delimiter);
+   m_prefetcher.async(m_pending);
+}
+
+const size_t PartitionedListing::PARTITIONS_PER_THREAD = 4;
+const int PartitionedListing::MAX_SPLIT_PROBES = 32;
+const size_t PartitionedListing::MAX_QUEUED_PAGES = 2;
+
+PartitionedListing::PartitionedListing(BB& bb, const string& bucketId, int numThreads, const string& startFileName, const string& prefix, uint64_t maxFileCount)
+   :  m_bb(bb),
+      m_bucketId(bucketId),
+      m_prefix(prefix),
+      m_limited(maxFileCount > 0),
+      m_remaining(maxFileCount),
+      m_pageFileCount(FileNameListing::MAX_PAGE_FILE_COUNT),
+      m_claimed(0),
+      m_current(0),
+      m_position(0),
+      m_probing(0),
+      m_cancelled(false) {
+   pthread_mutex_init(&m_mutex, NULL);
+   pthread_cond_init(&m_condition, NULL);
+
+   if (m_limited) {
+      m_pageFileCount = static_cast<int>(std::min(maxFileCount, static_cast<uint64_t>(FileNameListing::MAX_PAGE_FILE_COUNT)));
+   }
+
+   // the first page is needed whatever happens, and a small bucket ends there
+   const string start = std::max(startFileName, prefix);
+   string nextFileName;
+   ObjectList first = m_bb.listFileNames(m_bucketId, start, m_pageFileCount, nextFileName, m_prefix);
+   m_partitions.push_back(Partition(start, nextFileName));
+   m_partitions.back().pages.push_back(ObjectList());
+   m_partitions.back().pages.back().swap(first);
+   m_partitions.back().finished = true;
+   m_claimed = 1;
+   if (nextFileName.empty() || (m_limited && m_partitions.back().pages.back().size() >= maxFileCount)) {
+      return;
+   }
+
+   const size_t threads = static_cast<size_t>(std::max(1, numThreads));
+   m_dispatcho.reset(new Dispatcho(static_cast<int>(threads)));
+   vector<string> splits = sample(threads * PARTITIONS_PER_THREAD);
+
+   string from = nextFileName;
+   for (vector<string>::const_iterator iter = splits.begin(); iter != splits.end(); ++iter) {
+      if (*iter > from) {
+         m_partitions.push_back(Partition(from, *iter));
+         from = *iter;
+      }
+   }
+   m_partitions.push_back(Partition(from, ""));
+
+   for (size_t i = 0; i < std::min(threads, m_partitions.size() - 1); ++i) {
+      m_workers.push_back(new Worker(*this));
+      m_dispatcho->async(m_workers.back());
+   }
+}
+
+PartitionedListing::~PartitionedListing() {
+   pthread_mutex_lock(&m_mutex);
+   m_cancelled = true;
+   pthread_cond_broadcast(&m_condition);
+   pthread_mutex_unlock(&m_mutex);
+
+   if (m_dispatcho) {
+      m_dispatcho->workoff();
+      m_dispatcho.reset();
+   }
+   for (vector<Worker*>::iterator iter = m_workers.begin(); iter != m_workers.end(); ++iter) {
+      delete (*iter);
+   }
+   pthread_mutex_destroy(&m_mutex);
+   pthread_cond_destroy(&m_condition);
+}
+
+bool PartitionedListing::next(BB_Object& object) {
+   if (m_limited && m_remaining == 0) {
+      return false;
+   }
+   while (m_position == m_page.size()) {
+      pthread_mutex_lock(&m_mutex);
+      while (!m_failure && m_error.empty() && m_current < m_partitions.size()
+             && m_partitions[m_current].pages.empty() && !m_partitions[m_current].finished) {
+         pthread_cond_wait(&m_condition, &m_mutex);
+      }
+      if (m_failure || !m_error.empty()) {
+         pthread_mutex_unlock(&m_mutex);
+         if (m_failure) {
+            throw ResponseError(*m_failure);
+         }
+         throw std::runtime_error(m_error);
+      }
+      if (m_current == m_partitions.size()) {
+         pthread_mutex_unlock(&m_mutex);
+         return false;
+      }
+      Partition& partition = m_partitions[m_current];
+      if (!partition.pages.empty()) {
+         m_page.swap(partition.pages.front());
+         m_position = 0;
+         partition.pages.pop_front();
+         // the worker may be waiting for room in its queue
+         pthread_cond_broadcast(&m_condition);
+      } else {
+         m_current++;
+      }
+      pthread_mutex_unlock(&m_mutex);
+   }
+   object = m_page.at(m_position++);
+   if (m_limited && --m_remaining == 0) {
+      // nothing more will be handed out, the workers can stop listing
+      pthread_mutex_lock(&m_mutex);
+      m_cancelled = true;
+      pthread_cond_broadcast(&m_condition);
+      pthread_mutex_unlock(&m_mutex);
+   }
+   return true;
+}
+
+vector<string> PartitionedListing::sample(size_t wanted) {
+   std::set<string> candidates;
+   int probes = 0;
+
+   // flat names split by the character that follows the prefix, these
+   // share the first round with the top level folder
+   vector<Probe*> round;
+   const size_t steps = wanted * 2;
+   for (size_t i = 1; i < steps && probes < MAX_SPLIT_PROBES / 2; ++i, ++probes) {
+      const string key = m_prefix + static_cast<char>(0x20 + i * 0x5f / steps);
+      round.push_back(new Probe(*this, key, m_prefix, "", 1));
+   }
+
+   // hierarchical names split well at their folders
+   vector<string> folders(1, m_prefix);
+   while (!folders.empty() && probes < MAX_SPLIT_PROBES && candidates.size() < wanted * 4) {
+      for (vector<string>::const_iterator folder = folders.begin(); folder != folders.end() && probes < MAX_SPLIT_PROBES; ++folder, ++probes) {
+         round.push_back(new Probe(*this, "", *folder, "/", 1000));
+      }
+      probe(round);
+
+      folders.clear();
+      for (vector<Probe*>::iterator iter = round.begin(); iter != round.end(); ++iter) {
+         const ObjectList& files = (*iter)->files;
+         for (ObjectList::const_iterator file = files.begin(); file != files.end(); ++file) {
+            const BB_Object object = *file;
+            candidates.insert(object.name);
+            if (object.action == "folder") {
+               folders.push_back(object.name);
+            }
+         }
+         delete (*iter);
+      }
+      round.clear();
+   }
+
+   // evenly spaced among what was found
+   vector<string> sorted(candidates.begin(), candidates.end());
+   vector<string> splits;
+   for (size_t i = 1; i < wanted && !sorted.empty(); ++i) {
+      const string& split = sorted[i * sorted.size() / wanted];
+      if (splits.empty() || splits.back() != split) {
+         splits.push_back(split);
+      }
+   }
+   return splits;
+}
+
+void PartitionedListing::probe(const vector<Probe*>& probes) {
+   pthread_mutex_lock(&m_mutex);
+   m_probing = probes.size();
+   pthread_mutex_unlock(&m_mutex);
+   for (vector<Probe*>::const_iterator iter = probes.begin(); iter != probes.end(); ++iter) {
+      m_dispatcho->async(*iter);
+   }
+   pthread_mutex_lock(&m_mutex);
+   while (m_probing > 0) {
+      pthread_cond_wait(&m_condition, &m_mutex);
+   }
+   pthread_mutex_unlock(&m_mutex);
+}
+
+bool PartitionedListing::claim(size_t& index) {
+   pthread_mutex_lock(&m_mutex);
+   bool claimed = !m_cancelled && !m_failure && m_error.empty() && m_claimed < m_partitions.size();
+   if (claimed) {
+      index = m_claimed++;
+   }
+   pthread_mutex_unlock(&m_mutex);
+   return claimed;
+}
+
+bool PartitionedListing::deliver(size_t index, ObjectList& page, bool last) {
+   pthread_mutex_lock(&m_mutex);
+   Partition& partition = m_partitions[index];
+   while (!m_cancelled && !m_failure && m_error.empty() && partition.pages.size() >= MAX_QUEUED_PAGES) {
+      pthread_cond_wait(&m_condition, &m_mutex);
+   }
+   bool delivered = !m_cancelled && !m_failure && m_error.empty();
+   if (delivered) {
+      partition.pages.push_back(ObjectList());
+      partition.pages.back().swap(page);
+      partition.finished = last;
+      pthread_cond_broadcast(&m_condition);
+   }
+   pthread_mutex_unlock(&m_mutex);
+   return delivered;
+}
+
+void PartitionedListing::fail(const ResponseError* failure, const string& error) {
+   pthread_mutex_lock(&m_mutex);
+   if (!m_failure && m_error.empty()) {
+      if (failure) {
+         m_failure.reset(new ResponseError(*failure));
+      } else {
+         m_error = error.empty() ? "listing failed" : error;
+      }
+   }
+   pthread_cond_broadcast(&m_condition);
+   pthread_mutex_unlock(&m_mutex);
+}
+
+void PartitionedListing::listPartition(size_t index) {
+   const Partition& partition = m_partitions[index];
+   string startFileName = partition.start;
+   bool last = false;
+   while (!last) {
+      string nextFileName;
+      ObjectList page = m_bb.listFileNames(m_bucketId, startFileName, m_pageFileCount, nextFileName, m_prefix);
+      if (!partition.stop.empty()) {
+         // the tail of the last page belongs to the next partition
+         size_t end = 0;
+         while (end < page.size() && page.name(end) < partition.stop) {
+            ++end;
+         }
+         if (end < page.size() || nextFileName >= partition.stop) {
+            page.truncate(end);
+            nextFileName.clear();
+         }
+      }
+      last = nextFileName.empty();
+      startFileName = nextFileName;
+      if (!deliver(index, page, last)) {
+         return;
+      }
+   }
+}
+
+PartitionedListing::Probe::Probe(PartitionedListing& listing, const string& startFileName, const string& prefix, const string& delimiter, int maxFileCount)
+   :  Task(NULL, "list_probe_task"),
+      m_listing(listing),
+      m_startFileName(startFileName),
+      m_prefix(prefix),
+      m_delimiter(delimiter),
+      m_maxFileCount(maxFileCount) {
+}
+
+int PartitionedListing::Probe::run() {
+   // split points are only a hint, the listing proper reports any failure
+   try {
+      string nextFileName;
+      files = m_listing.m_bb.listFileNames(m_listing.m_bucketId, m_startFileName, m_maxFileCount, nextFileName, m_prefix, m_delimiter);
+   } catch(...) {
+      files = ObjectList();
+   }
+   pthread_mutex_lock(&m_listing.m_mutex);
+   m_listing.m_probing--;
+   pthread_cond_broadcast(&m_listing.m_condition);
+   pthread_mutex_unlock(&m_listing.m_mutex);
+   return EXIT_SUCCESS;
+}
+
+int PartitionedListing::Worker::run() {
+   size_t index;
+   // as with ListPageTask, errors are passed on rather than returned
+   while (m_listing.claim(index)) {
+      try {
+         m_listing.listPartition(index);
+      } catch(const ResponseError& err) {
+         m_listing.fail(&err, "");
+      } catch(const std::exception& e) {
+         m_listing.fail(NULL, e.what());
+      }
+   }
+   return EXIT_SUCCESS;
+}
+
+} // namespace khi
@@ -0,0 +1,267 @@
+// vim:set et ts=3 sw=3:
+// __  __ ______ _______ _______ _______ ______ 
+// |  |/  |   __ \   |   |     __|    ___|   __ \
+// |     <|      <   |   |    |  |    ___|      <
+// |__|\__|___|__|_______|_______|_______|___|__|
+//        H E A V Y  I N D U S T R I E S
+//
+// Copyright (C) 2024 Kruger Heavy Industries
+// http://www.krugerheavyindustries.com
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty.  In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#ifndef LISTING_H
+#define LISTING_H
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <pthread.h>
+
+#include "bb.h"
+#include "dispatcho.h"
+#include "exceptions.h"
+
+namespace khi {
+
+// A sequence of file names handed out one at a time in B2's sort order.
+class Listing {
+
+   public:
+
+   virtual ~Listing() {}
+
+   // false once the listing is exhausted
+   virtual bool next(BB_Object& object) = 0;
+};
+
+// Fetches a single page of b2_list_file_names on a worker thread. The
+// thread that queued it waits for the result, which is either the page or
+// whatever the request threw.
+class ListPageTask : public Task {
+
+   public:
+
+   ListPageTask(BB& bb, const std::string& bucketId, const std::string& startFileName, int maxFileCount, const std::string& prefix, const std::string& delimiter);
+
+   virtual ~ListPageTask();
+
+   // always succeeds, a failed request is kept for wait() to rethrow
+   virtual int run();
+
+   // blocks until run() has finished, rethrowing anything it caught
+   void wait();
+
+   inline ObjectList& files() {
+      return m_files;
+   }
+
+   inline const std::string& nextFileName() const {
+      return m_nextFileName;
+   }
+
+   private:
+
+   ListPageTask(const ListPageTask&); // prevent copy
+   ListPageTask& operator=(const ListPageTask&); // prevent assign
+
+   BB& m_bb;
+   const std::string m_bucketId;
+   const std::string m_startFileName;
+   const int m_maxFileCount;
+   const std::string m_prefix;
+   const std::string m_delimiter;
+
+   ObjectList m_files;
+   std::string m_nextFileName;
+
+   bool m_finished;
+   std::unique_ptr<ResponseError> m_failure;
+   std::string m_error;
+   pthread_mutex_t m_mutex;
+   pthread_cond_t m_condition;
+};
+
+// Walks every file name in a bucket by following nextFileName from page to
+// page. Only the page being consumed and the one after it are ever held,
+// the latter being fetched in the background while the former is read, so
+// memory stays flat however large the bucket is.
+//
+//    FileNameListing listing(bb, bucketId);
+//    BB_Object object;
+//    while (listing.next(object)) {
+//       ...
+//    }
+class FileNameListing : public Listing {
+
+   public:
+
+   static const int MAX_PAGE_FILE_COUNT;
+
+   // a maxFileCount of 0 lists the whole bucket, or everything under prefix.
+   // With a delimiter, names continuing past it below the prefix come back
+   // once as a folder entry whose action is "folder".
+   FileNameListing(BB& bb, const std::string& bucketId, const std::string& startFileName = "", uint64_t maxFileCount = 0, const std::string& prefix = "", const std::string& delimiter = "");
+
+   ~FileNameListing();
+
+   virtual bool next(BB_Object& object);
+
+   private:
+
+   FileNameListing(const FileNameListing&); // prevent copy
+   FileNameListing& operator=(const FileNameListing&); // prevent assign
+
+   void prefetch(const std::string& startFileName);
+
+   BB& m_bb;
+   const std::string m_bucketId;
+   const std::string m_prefix;
+   const std::string m_delimiter;
+   const bool m_limited;
+   uint64_t m_remaining;
+
+   ObjectList m_page;
+   size_t m_position;
+   ListPageTask* m_pending;
+   Dispatcho m_prefetcher;
+};
+
+// Lists a bucket with several cursors at once. Each b2_list_file_names call
+// needs the nextFileName of the one before it, so a single cursor is
+// strictly sequential; instead the key space is cut at sampled split
+// points into partitions, each listed from its start name up to the next
+// one's on a worker of its own. Partitions are disjoint and ordered, so
+// handing them out one after the other yields the same order as a single
+// cursor would.
+//
+// The first page is fetched on its own; when it is the only one, or holds
+// as many names as were asked for, there is nothing to partition. Otherwise
+// split points come from a few cheap probes run side by side on the pool:
+// the folders found walking down from the prefix with a / delimiter, a
+// level at a time, and for flat name spaces the first name found after
+// evenly spaced characters. Partitions are claimed in order and each holds
+// at most a couple of pages that have not been handed out, so memory stays
+// bounded by the number of threads.
+class PartitionedListing : public Listing {
+
+   public:
+
+   static const size_t PARTITIONS_PER_THREAD;
+   static const int MAX_SPLIT_PROBES;
+   static const size_t MAX_QUEUED_PAGES;
+
+   // a maxFileCount of 0 lists everything, otherwise the listing stops
+   // after that many names
+   PartitionedListing(BB& bb, const std::string& bucketId, int numThreads, const std::string& startFileName = "", const std::string& prefix = "", uint64_t maxFileCount = 0);
+
+   virtual ~PartitionedListing();
+
+   virtual bool next(BB_Object& object);
+
+   // partitions planned, for diagnostics
+   inline size_t partitions() const {
+      return m_partitions.size();
+   }
+
+   private:
+
+   PartitionedListing(const PartitionedListing&); // prevent copy
+   PartitionedListing& operator=(const PartitionedListing&); // prevent assign
+
+   struct Partition {
+      std::string start;
+      std::string stop; // empty for the last partition
+      std::deque<ObjectList> pages;
+      bool finished;
+
+      Partition(const std::string& s, const std::string& e) : start(s), stop(e), finished(false) {}
+   };
+
+   class Worker : public Task {
+
+      public:
+
+      explicit Worker(PartitionedListing& listing) : Task(NULL, "list_partition_task"), m_listing(listing) {}
+
+      virtual int run();
+
+      private:
+
+      PartitionedListing& m_listing;
+   };
+
+   // one b2_list_file_names call made while sampling, a failed one simply
+   // contributes nothing
+   class Probe : public Task {
+
+      public:
+
+      Probe(PartitionedListing& listing, const std::string& startFileName, const std::string& prefix, const std::string& delimiter, int maxFileCount);
+
+      virtual int run();
+
+      ObjectList files;
+
+      private:
+
+      PartitionedListing& m_listing;
+      const std::string m_startFileName;
+      const std::string m_prefix;
+      const std::string m_delimiter;
+      const int m_maxFileCount;
+   };
+
+   std::vector<std::string> sample(size_t wanted);
+
+   // run a round of probes on the pool and wait for all of them
+   void probe(const std::vector<Probe*>& probes);
+
+   bool claim(size_t& index);
+
+   bool deliver(size_t index, ObjectList& page, bool last);
+
+   void fail(const ResponseError* failure, const std::string& error);
+
+   void listPartition(size_t index);
+
+   BB& m_bb;
+   const std::string m_bucketId;
+   const std::string m_prefix;
+   const bool m_limited;
+   uint64_t m_remaining;
+   int m_pageFileCount;
+
+   std::vector<Partition> m_partitions;
+   std::vector<Worker*> m_workers;
+   size_t m_claimed;
+   size_t m_current;
+   ObjectList m_page;
+   size_t m_position;
+   size_t m_probing;
+
+   bool m_cancelled;
+   std::unique_ptr<ResponseError> m_failure;
+   std::string m_error;
+   pthread_mutex_t m_mutex;
+   pthread_cond_t m_condition;
+   std::unique_ptr<Dispatcho> m_dispatcho;
+};
+
+} // namespace khi
+#endif // LISTING_H
@@ -0,0 +1,142 @@
+// vim:set et ts=3 sw=3:
+// __  __ ______ _______ _______ _______ ______ 
+// |  |/  |   __ \   |   |     __|    ___|   __ \
+// |     <|      <   |   |    |  |    ___|      <
+// |__|\__|___|__|_______|_______|_______|___|__|
+//        H E A V Y  I N D U S T R I E S
+//
+// Copyright (C) 2024 Kruger Heavy Industries
+// http://www.krugerheavyindustries.com
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty.  In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "object_list.h"
+
+#include <stdexcept>
+
+#include "bb.h"
+#include "coding.h"
+
+using namespace std;
+
+namespace khi {
+
+namespace {
+
+   const string UNVERIFIED = "unverified:";
+}
+
+BB_Object ObjectList::const_iterator::operator*() const {
+   return m_list->at(m_index);
+}
+
+uint16_t ObjectList::Strings::intern(const string& value) {
+   map<string, uint16_t>::const_iterator found = index.find(value);
+   if (found != index.end()) {
+      return found->second;
+   }
+   if (values.size() > 0xffff) {
+      throw std::runtime_error("too many distinct values to intern");
+   }
+   const uint16_t id = static_cast<uint16_t>(values.size());
+   values.push_back(value);
+   index[value] = id;
+   return id;
+}
+
+ObjectList::ObjectList() {
+}
+
+void ObjectList::push_back(const BB_Object& object) {
+   Entry entry;
+   entry.nameOffset = store(object.name);
+   entry.nameLength = static_cast<uint32_t>(object.name.size());
+   entry.idOffset = store(object.id);
+   entry.idLength = static_cast<uint16_t>(std::min(object.id.size(), static_cast<size_t>(0xffff)));
+   entry.contentLength = object.contentLength;
+   entry.uploadTimestamp = object.uploadTimestamp;
+   entry.type = m_types.intern(object.contentType);
+   entry.action = m_actions.intern(object.action);
+   entry.flags = 0;
+
+   // large files have "none", their hash may be in their file info instead
+   const string& sha1 = object.contentSha1;
+   if (decodeHex(sha1, entry.sha1, sizeof(entry.sha1))) {
+      entry.flags |= HAS_SHA1;
+   } else if (sha1.compare(0, UNVERIFIED.size(), UNVERIFIED) == 0 && decodeHex(sha1.substr(UNVERIFIED.size()), entry.sha1, sizeof(entry.sha1))) {
+      entry.flags |= HAS_SHA1 | UNVERIFIED_SHA1;
+   } else {
+      if (sha1 == "none") {
+         entry.flags |= NO_SHA1;
+      }
+      if (decodeHex(object.largeFileSha1, entry.sha1, sizeof(entry.sha1))) {
+         entry.flags |= LARGE_FILE_SHA1;
+      }
+   }
+   m_entries.push_back(entry);
+}
+
+BB_Object ObjectList::at(size_t index) const {
+   const Entry& entry = m_entries.at(index);
+   BB_Object object;
+   object.name.assign(m_text.data() + entry.nameOffset, entry.nameLength);
+   object.id.assign(m_text.data() + entry.idOffset, entry.idLength);
+   object.contentLength = entry.contentLength;
+   object.uploadTimestamp = entry.uploadTimestamp;
+   object.contentType = m_types.values[entry.type];
+   object.action = m_actions.values[entry.action];
+   if (entry.flags & HAS_SHA1) {
+      const string hex = encodeHex(entry.sha1, sizeof(entry.sha1));
+      object.contentSha1 = (entry.flags & UNVERIFIED_SHA1) ? UNVERIFIED + hex : hex;
+   } else {
+      object.contentSha1 = (entry.flags & NO_SHA1) ? "none" : "";
+      if (entry.flags & LARGE_FILE_SHA1) {
+         object.largeFileSha1 = encodeHex(entry.sha1, sizeof(entry.sha1));
+      }
+   }
+   return object;
+}
+
+void ObjectList::swap(ObjectList& other) {
+   m_entries.swap(other.m_entries);
+   m_text.swap(other.m_text);
+   m_types.values.swap(other.m_types.values);
+   m_types.index.swap(other.m_types.index);
+   m_actions.values.swap(other.m_actions.values);
+   m_actions.index.swap(other.m_actions.index);
+}
+
+void ObjectList::truncate(size_t count) {
+   if (count < m_entries.size()) {
+      // each file's name and id are stored together, after those before it
+      m_text.resize(m_entries[count].nameOffset);
+      m_entries.resize(count);
+   }
+}
+
+string ObjectList::name(size_t index) const {
+   const Entry& entry = m_entries.at(index);
+   return string(m_text.data() + entry.nameOffset, entry.nameLength);
+}
+
+uint64_t ObjectList::store(const string& value) {
+   const uint64_t offset = m_text.size();
+   m_text.insert(m_text.end(), value.begin(), value.end());
+   return offset;
+}
+
+} // namespace khi
@@ -0,0 +1,149 @@
+// vim:set et ts=3 sw=3:
+// __  __ ______ _______ _______ _______ ______ 
+// |  |/  |   __ \   |   |     __|    ___|   __ \
+// |     <|      <   |   |    |  |    ___|      <
+// |__|\__|___|__|_______|_______|_______|___|__|
+//        H E A V Y  I N D U S T R I E S
+//
+// Copyright (C) 2024 Kruger Heavy Industries
+// http://www.krugerheavyindustries.com
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty.  In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#ifndef OBJECT_LIST_H
+#define OBJECT_LIST_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <iterator>
+#include <cstddef>
+#include <stdint.h>
+
+namespace khi {
+
+struct BB_Object;
+
+// A compact, append only sequence of listed files for listings too large
+// to hold as one heap node per file with five strings each. Every file is
+// a fixed size entry in one contiguous vector; names and ids go into a
+// shared character arena, content types and actions are interned once
+// each and referred to by number, and SHA1s are kept as 20 raw bytes.
+// Walking the entries touches memory in order, and a file costs its
+// entry plus the bytes of its name and id rather than several allocations.
+class ObjectList {
+
+   public:
+
+   class const_iterator {
+
+      public:
+
+      // dereferencing unpacks a copy, which is all an input iterator promises
+      typedef std::input_iterator_tag iterator_category;
+      typedef BB_Object value_type;
+      typedef std::ptrdiff_t difference_type;
+      typedef const BB_Object* pointer;
+      typedef BB_Object reference;
+
+      const_iterator() : m_list(NULL), m_index(0) {}
+      const_iterator(const ObjectList& list, size_t index) : m_list(&list), m_index(index) {}
+
+      // files are unpacked on demand, so iteration yields copies
+      BB_Object operator*() const;
+
+      const_iterator& operator++() { ++m_index; return *this; }
+      const_iterator operator++(int) { const_iterator prev(*this); ++m_index; return prev; }
+
+      bool operator==(const const_iterator& other) const { return m_index == other.m_index && m_list == other.m_list; }
+      bool operator!=(const const_iterator& other) const { return !(*this == other); }
+
+      private:
+
+      const ObjectList* m_list;
+      size_t m_index;
+   };
+
+   ObjectList();
+
+   void push_back(const BB_Object& object);
+
+   BB_Object at(size_t index) const;
+
+   inline size_t size() const {
+      return m_entries.size();
+   }
+
+   inline bool empty() const {
+      return m_entries.empty();
+   }
+
+   void swap(ObjectList& other);
+
+   // drop every file from index count on
+   void truncate(size_t count);
+
+   inline const_iterator begin() const {
+      return const_iterator(*this, 0);
+   }
+
+   inline const_iterator end() const {
+      return const_iterator(*this, m_entries.size());
+   }
+
+   // just the name, without unpacking the rest of the file
+   std::string name(size_t index) const;
+
+   private:
+
+   enum Flags {
+      HAS_SHA1 = 1,
+      LARGE_FILE_SHA1 = 2,
+      UNVERIFIED_SHA1 = 4,
+      NO_SHA1 = 8
+   };
+
+   struct Entry {
+      uint64_t nameOffset;
+      uint64_t idOffset;
+      uint64_t contentLength;
+      uint64_t uploadTimestamp;
+      uint32_t nameLength;
+      uint16_t idLength;
+      uint16_t type;
+      uint8_t sha1[20];
+      uint16_t action;
+      uint8_t flags;
+   };
+
+   struct Strings {
+      std::vector<std::string> values;
+      std::map<std::string, uint16_t> index;
+
+      uint16_t intern(const std::string& value);
+   };
+
+   uint64_t store(const std::string& value);
+
+   std::vector<Entry> m_entries;
+   std::vector<char> m_text;
+   Strings m_types;
+   Strings m_actions;
+};
+
+} // namespace khi
+#endif // OBJECT_LIST_H
@@ -0,0 +1,201 @@
+// vim:set et ts=3 sw=3:
+// __  __ ______ _______ _______ _______ ______ 
+// |  |/  |   __ \   |   |     __|    ___|   __ \
+// |     <|      <   |   |    |  |    ___|      <
+// |__|\__|___|__|_______|_______|_______|___|__|
+//        H E A V Y  I N D U S T R I E S
+//
+// Copyright (C) 2024 Kruger Heavy Industries
+// http://www.krugerheavyindustries.com
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty.  In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <vector>
+#include <map>
+#include <string>
+#include <memory>
+#include <pthread.h>
+
+namespace khi {
+
+// A thread safe free list of reusable items. Items are created on demand
+// by a Lease when the pool has nothing idle, so the number alive never
+// exceeds the number of threads holding one at the same time.
+template <typename T>
+class Pool {
+
+   public:
+
+   class Lease {
+
+      public:
+
+      explicit Lease(Pool& pool)
+         :  m_pool(pool),
+            m_item(pool.checkout()) {
+         if (m_item == NULL) {
+            m_item = new T();
+         }
+      }
+
+      ~Lease() {
+         if (m_item) {
+            m_pool.checkin(m_item);
+         }
+      }
+
+      // drop the item instead of returning it to the pool
+      void discard() {
+         delete m_item;
+         m_item = NULL;
+      }
+
+      T& operator*() const { return *m_item; }
+      T* operator->() const { return m_item; }
+
+      private:
+
+      Lease(const Lease&); // prevent copy
+      Lease& operator=(const Lease&); // prevent assign
+
+      Pool& m_pool;
+      T* m_item;
+   };
+
+   Pool() {
+      pthread_mutex_init(&m_mutex, NULL);
+   }
+
+   ~Pool() {
+      clear();
+      pthread_mutex_destroy(&m_mutex);
+   }
+
+   // an idle item, or NULL when every item is checked out
+   T* checkout() {
+      T* item = NULL;
+      pthread_mutex_lock(&m_mutex);
+      if (!m_idle.empty()) {
+         item = m_idle.back();
+         m_idle.pop_back();
+      }
+      pthread_mutex_unlock(&m_mutex);
+      return item;
+   }
+
+   void checkin(T* item) {
+      pthread_mutex_lock(&m_mutex);
+      m_idle.push_back(item);
+      pthread_mutex_unlock(&m_mutex);
+   }
+
+   void clear() {
+      pthread_mutex_lock(&m_mutex);
+      for (typename std::vector<T*>::iterator iter = m_idle.begin(); iter != m_idle.end(); ++iter) {
+         delete (*iter);
+      }
+      m_idle.clear();
+      pthread_mutex_unlock(&m_mutex);
+   }
+
+   private:
+
+   Pool(const Pool&); // prevent copy
+   Pool& operator=(const Pool&); // prevent assign
+
+   std::vector<T*> m_idle;
+   pthread_mutex_t m_mutex;
+};
+
+// Idle items kept per key, for things like connections that are tied to the
+// base url they were created for. A Handle puts its item back under the
+// same key when it goes out of scope.
+template <typename T>
+class KeyedPool {
+
+   public:
+
+   struct Checkin {
+      KeyedPool* pool;
+      std::string key;
+
+      void operator()(T* item) const {
+         pool->checkin(key, item);
+      }
+   };
+
+   typedef std::unique_ptr<T, Checkin> Handle;
+
+   KeyedPool() {
+      pthread_mutex_init(&m_mutex, NULL);
+   }
+
+   ~KeyedPool() {
+      clear();
+      pthread_mutex_destroy(&m_mutex);
+   }
+
+   // an idle item for key, or a new one constructed from key
+   Handle lease(const std::string& key) {
+      T* item = NULL;
+      pthread_mutex_lock(&m_mutex);
+      typename Items::iterator idle = m_idle.find(key);
+      if (idle != m_idle.end() && !idle->second.empty()) {
+         item = idle->second.back();
+         idle->second.pop_back();
+      }
+      pthread_mutex_unlock(&m_mutex);
+      if (item == NULL) {
+         item = new T(key);
+      }
+      Checkin checkin = { this, key };
+      return Handle(item, checkin);
+   }
+
+   void checkin(const std::string& key, T* item) {
+      pthread_mutex_lock(&m_mutex);
+      m_idle[key].push_back(item);
+      pthread_mutex_unlock(&m_mutex);
+   }
+
+   void clear() {
+      pthread_mutex_lock(&m_mutex);
+      for (typename Items::iterator idle = m_idle.begin(); idle != m_idle.end(); ++idle) {
+         for (typename std::vector<T*>::iterator iter = idle->second.begin(); iter != idle->second.end(); ++iter) {
+            delete (*iter);
+         }
+      }
+      m_idle.clear();
+      pthread_mutex_unlock(&m_mutex);
+   }
+
+   private:
+
+   KeyedPool(const KeyedPool&); // prevent copy
+   KeyedPool& operator=(const KeyedPool&); // prevent assign
+
+   typedef std::map<std::string, std::vector<T*> > Items;
+
+   Items m_idle;
+   pthread_mutex_t m_mutex;
+};
+
+} // namespace khi
+#endif // POOL_H
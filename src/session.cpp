@@ -33,19 +33,26 @@
 
 #include <pwd.h>
 #include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
 
 using namespace std; 
 
 #define PATH_BLAZER_DIR ".blazer"
 #define SECONDS_IN_DAY 86400
 
-Session::Session() { 
+Session::Session() 
+   :  recommendedPartSize(0),
+      absoluteMinimumPartSize(0)
+{ 
 }
 
 Session::Session(const string& _authorizationToken, const string& _apiUrl, const string& _downloadUrl) 
    :  authorizationToken(_authorizationToken), 
       apiUrl(_apiUrl), 
-      downloadUrl(_downloadUrl)
+      downloadUrl(_downloadUrl),
+      recommendedPartSize(0),
+      absoluteMinimumPartSize(0)
 {
 }
 
@@ -62,6 +69,11 @@ Session Session::load() {
          ss >> timestamp;
          if (ss && (currentTime - timestamp) < SECONDS_IN_DAY)  {
             strm >> session.authorizationToken >> session.apiUrl >> session.downloadUrl;
+            // absent from sessions saved by earlier versions
+            if (!(strm >> session.recommendedPartSize >> session.absoluteMinimumPartSize)) {
+               session.recommendedPartSize = 0;
+               session.absoluteMinimumPartSize = 0;
+            }
          } else { 
             break; 
          }
@@ -72,10 +84,12 @@ Session Session::load() {
 }
 
 void Session::save() { 
+   createDirectory();
    ofstream strm(path().c_str());
    if (strm && valid()) { 
       time_t ts = time(NULL);
-      strm << ts << " " << authorizationToken << " " << apiUrl << " " << downloadUrl;
+      strm << ts << " " << authorizationToken << " " << apiUrl << " " << downloadUrl
+           << " " << recommendedPartSize << " " << absoluteMinimumPartSize;
    }
    strm.close();
 }
@@ -88,7 +102,15 @@ bool Session::unknown() {
    return authorizationToken.empty() && apiUrl.empty() && downloadUrl.empty();
 }
 
-string Session::path() { 
+string Session::directory() { 
    struct passwd* pw = getpwuid(geteuid());
-   return string(string(pw->pw_dir) + "/" + PATH_BLAZER_DIR + "/" + "session");
+   return string(string(pw->pw_dir) + "/" + PATH_BLAZER_DIR);
+}
+
+bool Session::createDirectory() {
+   return mkdir(directory().c_str(), 0700) == 0 || errno == EEXIST;
+}
+
+string Session::path() { 
+   return directory() + "/" + "session";
 }
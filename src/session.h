@@ -28,6 +28,7 @@
 #define SESSION_H
 
 #include <string>
+#include <stdint.h>
 
 class Session { 
 
@@ -45,10 +46,20 @@ class Session {
 
    bool unknown();
 
+   // the per user blazer directory the session file lives in
+   static std::string directory();
+
+   // create directory() when it is missing, false when it cannot be used
+   static bool createDirectory();
+
    std::string authorizationToken;
    std::string apiUrl;
    std::string downloadUrl;
 
+   // part sizes advertised by b2_authorize_account, zero when unknown
+   uint64_t recommendedPartSize;
+   uint64_t absoluteMinimumPartSize;
+
    private: 
 
    static std::string path();
@@ -0,0 +1,470 @@
+// vim:set et ts=3 sw=3:
+// __  __ ______ _______ _______ _______ ______ 
+// |  |/  |   __ \   |   |     __|    ___|   __ \
+// |     <|      <   |   |    |  |    ___|      <
+// |__|\__|___|__|_______|_______|_______|___|__|
+//        H E A V Y  I N D U S T R I E S
+//
+// Copyright (C) 2024 Kruger Heavy Industries
+// http://www.krugerheavyindustries.com
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty.  In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "transfer.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+using namespace std;
+
+namespace {
+
+   // TLS sessions and DNS lookups are shared between every transfer handle
+   // so a worker opening a second connection to a host it has already
+   // talked to can skip most of the handshake
+   pthread_once_t shareOnce = PTHREAD_ONCE_INIT;
+   pthread_mutex_t shareLocks[CURL_LOCK_DATA_LAST];
+   CURLSH* share = NULL;
+
+   void lockShare(CURL*, curl_lock_data data, curl_lock_access, void*) {
+      pthread_mutex_lock(&shareLocks[data]);
+   }
+
+   void unlockShare(CURL*, curl_lock_data data, void*) {
+      pthread_mutex_unlock(&shareLocks[data]);
+   }
+
+   void initShare() {
+      for (int i = 0; i < CURL_LOCK_DATA_LAST; ++i) {
+         pthread_mutex_init(&shareLocks[i], NULL);
+      }
+      share = curl_share_init();
+      curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lockShare);
+      curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlockShare);
+      curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+      curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+   }
+}
+
+namespace khi {
+
+FileSource::FileSource(const string& filepath, uint64_t offset, uint64_t length, uint64_t* bytesRead)
+   :  m_filepath(filepath),
+      m_fd(open(filepath.c_str(), O_RDONLY)),
+      m_offset(offset),
+      m_remain(length),
+      m_bytesRead(bytesRead) {
+   if (m_fd < 0) {
+      throw std::runtime_error("could not read file " + filepath);
+   }
+}
+
+FileSource::~FileSource() {
+   close(m_fd);
+}
+
+size_t FileSource::read(char* buf, size_t len) {
+   size_t want = static_cast<size_t>(std::min(static_cast<uint64_t>(len), m_remain));
+   if (want == 0) {
+      return 0;
+   }
+   ssize_t count;
+   do {
+      count = pread(m_fd, buf, want, m_offset);
+   } while (count < 0 && errno == EINTR);
+   if (count <= 0) {
+      throw std::runtime_error("could not read all of " + m_filepath);
+   }
+   m_offset += count;
+   m_remain -= count;
+   if (m_bytesRead) {
+      *m_bytesRead += count;
+   }
+   return count;
+}
+
+MemorySource::MemorySource(const char* data, size_t length)
+   :  m_data(data),
+      m_remain(length) {
+}
+
+size_t MemorySource::read(char* buf, size_t len) {
+   size_t count = std::min(len, m_remain);
+   std::copy(m_data, m_data + count, buf);
+   m_data += count;
+   m_remain -= count;
+   return count;
+}
+
+FileSink::FileSink(int fd, uint64_t offset)
+   :  m_fd(fd),
+      m_offset(offset),
+      m_written(0) {
+}
+
+void FileSink::write(const char* data, size_t length) {
+   while (length > 0) {
+      ssize_t count = pwrite(m_fd, data, length, m_offset + m_written);
+      if (count < 0 && errno == EINTR) {
+         continue;
+      }
+      if (count <= 0) {
+         throw std::runtime_error("could not write downloaded data");
+      }
+      data += count;
+      length -= count;
+      m_written += count;
+   }
+}
+
+OrderedDigest::OrderedDigest(uint64_t totalBytes, size_t windowBytes)
+   :  m_totalBytes(totalBytes),
+      m_windowBytes(windowBytes),
+      m_next(0),
+      m_inline(0),
+      m_pendingBytes(0) {
+   pthread_mutex_init(&m_mutex, NULL);
+}
+
+OrderedDigest::~OrderedDigest() {
+   pthread_mutex_destroy(&m_mutex);
+}
+
+void OrderedDigest::update(uint64_t offset, const char* data, size_t length) {
+   pthread_mutex_lock(&m_mutex);
+   if (offset == m_next) {
+      m_digest.update(data, length);
+      m_next += length;
+      m_inline += length;
+      drain();
+   } else if (offset > m_next && m_pendingBytes + length <= m_windowBytes) {
+      m_pending[offset].assign(data, data + length);
+      m_pendingBytes += length;
+   }
+   // anything else is left for finish() to read back from the file
+   pthread_mutex_unlock(&m_mutex);
+}
+
+void OrderedDigest::drain() {
+   std::map<uint64_t, std::vector<char> >::iterator iter = m_pending.begin();
+   while (iter != m_pending.end() && iter->first <= m_next) {
+      const std::vector<char>& chunk = iter->second;
+      if (iter->first == m_next && !chunk.empty()) {
+         m_digest.update(&chunk[0], chunk.size());
+         m_next += chunk.size();
+         m_inline += chunk.size();
+      }
+      m_pendingBytes -= chunk.size();
+      m_pending.erase(iter++);
+   }
+}
+
+string OrderedDigest::finish(int fd) {
+   pthread_mutex_lock(&m_mutex);
+   drain();
+   m_pending.clear();
+   m_pendingBytes = 0;
+
+   std::vector<char> buffer(1024 * 1024);
+   while (m_next < m_totalBytes) {
+      size_t want = static_cast<size_t>(std::min(static_cast<uint64_t>(buffer.size()), m_totalBytes - m_next));
+      ssize_t count = pread(fd, &buffer[0], want, m_next);
+      if (count < 0 && errno == EINTR) {
+         continue;
+      }
+      if (count <= 0) {
+         pthread_mutex_unlock(&m_mutex);
+         throw std::runtime_error("could not read back downloaded data");
+      }
+      m_digest.update(&buffer[0], count);
+      m_next += count;
+   }
+   string hex = m_digest.hex();
+   pthread_mutex_unlock(&m_mutex);
+   return hex;
+}
+
+uint64_t OrderedDigest::hashedInline() const {
+   pthread_mutex_lock(&m_mutex);
+   uint64_t count = m_inline;
+   pthread_mutex_unlock(&m_mutex);
+   return count;
+}
+
+DigestSink::DigestSink(Sink& sink, OrderedDigest& digest, uint64_t offset)
+   :  m_sink(sink),
+      m_digest(digest),
+      m_offset(offset) {
+}
+
+void DigestSink::write(const char* data, size_t length) {
+   m_sink.write(data, length);
+   m_digest.update(m_offset, data, length);
+   m_offset += length;
+}
+
+CountingSink::CountingSink(Sink& sink)
+   :  m_sink(sink),
+      m_count(0) {
+}
+
+void CountingSink::write(const char* data, size_t length) {
+   m_sink.write(data, length);
+   m_count += length;
+}
+
+BufferSink::BufferSink(std::vector<char>& buffer)
+   :  m_buffer(buffer) {
+}
+
+void BufferSink::write(const char* data, size_t length) {
+   m_buffer.insert(m_buffer.end(), data, data + length);
+}
+
+ReorderRing::ReorderRing(size_t count, size_t slots)
+   :  m_count(count),
+      m_slots(std::max(static_cast<size_t>(1u), slots)),
+      m_ready(m_slots.size(), false),
+      m_claimed(0),
+      m_next(0),
+      m_failed(false) {
+   pthread_mutex_init(&m_mutex, NULL);
+   pthread_cond_init(&m_condition, NULL);
+}
+
+ReorderRing::~ReorderRing() {
+   pthread_mutex_destroy(&m_mutex);
+   pthread_cond_destroy(&m_condition);
+}
+
+bool ReorderRing::claim(size_t& index) {
+   pthread_mutex_lock(&m_mutex);
+   while (!m_failed && m_claimed < m_count && m_claimed >= m_next + m_slots.size()) {
+      pthread_cond_wait(&m_condition, &m_mutex);
+   }
+   bool claimed = !m_failed && m_claimed < m_count;
+   if (claimed) {
+      index = m_claimed++;
+   }
+   pthread_mutex_unlock(&m_mutex);
+   return claimed;
+}
+
+void ReorderRing::commit(size_t index, std::vector<char>& data) {
+   pthread_mutex_lock(&m_mutex);
+   const size_t slot = index % m_slots.size();
+   m_slots[slot].swap(data);
+   m_ready[slot] = true;
+   data.clear();
+   pthread_cond_broadcast(&m_condition);
+   pthread_mutex_unlock(&m_mutex);
+}
+
+bool ReorderRing::take(std::vector<char>& data) {
+   pthread_mutex_lock(&m_mutex);
+   const size_t slot = m_next % m_slots.size();
+   while (!m_failed && m_next < m_count && !m_ready[slot]) {
+      pthread_cond_wait(&m_condition, &m_mutex);
+   }
+   bool taken = !m_failed && m_next < m_count;
+   if (taken) {
+      data.clear();
+      data.swap(m_slots[slot]);
+      m_ready[slot] = false;
+      m_next++;
+      // frees the slot for the range slots places further on
+      pthread_cond_broadcast(&m_condition);
+   }
+   pthread_mutex_unlock(&m_mutex);
+   return taken;
+}
+
+void ReorderRing::fail() {
+   pthread_mutex_lock(&m_mutex);
+   m_failed = true;
+   pthread_cond_broadcast(&m_condition);
+   pthread_mutex_unlock(&m_mutex);
+}
+
+bool ReorderRing::failed() const {
+   pthread_mutex_lock(&m_mutex);
+   bool failed = m_failed;
+   pthread_mutex_unlock(&m_mutex);
+   return failed;
+}
+
+StreamSink::StreamSink(ostream& strm)
+   :  m_strm(strm) {
+}
+
+void StreamSink::write(const char* data, size_t length) {
+   if (!m_strm.write(data, length)) {
+      throw std::runtime_error("could not write downloaded data");
+   }
+}
+
+Sha1Source::Sha1Source(Source& source)
+   :  m_source(source),
+      m_trailerSent(0) {
+}
+
+size_t Sha1Source::read(char* buf, size_t len) {
+   if (m_hash.empty()) {
+      size_t count = m_source.read(buf, len);
+      if (count > 0) {
+         m_digest.update(buf, count);
+         return count;
+      }
+      m_hash = m_digest.hex();
+   }
+   size_t count = std::min(len, m_hash.size() - m_trailerSent);
+   m_hash.copy(buf, count, m_trailerSent);
+   m_trailerSent += count;
+   return count;
+}
+
+Transfer::Transfer(const string& baseUrl)
+   :  m_baseUrl(baseUrl),
+      m_curl(curl_easy_init()),
+      m_source(NULL),
+      m_sink(NULL),
+      m_response(NULL) {
+   if (m_curl == NULL) {
+      throw std::runtime_error("could not create transfer handle");
+   }
+}
+
+Transfer::~Transfer() {
+   curl_easy_cleanup(m_curl);
+}
+
+void Transfer::setHeaders(const RestClient::HeaderFields& headers) {
+   m_headers = headers;
+}
+
+RestClient::Response Transfer::post(const string& uri, Source& source, uint64_t length) {
+   m_source = &source;
+   curl_easy_setopt(m_curl, CURLOPT_POST, 1L);
+   curl_easy_setopt(m_curl, CURLOPT_READFUNCTION, readCallback);
+   curl_easy_setopt(m_curl, CURLOPT_READDATA, this);
+   curl_easy_setopt(m_curl, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(length));
+   RestClient::Response response = perform(uri);
+   m_source = NULL;
+   return response;
+}
+
+RestClient::Response Transfer::get(const string& uri, Sink& sink) {
+   m_sink = &sink;
+   curl_easy_setopt(m_curl, CURLOPT_HTTPGET, 1L);
+   RestClient::Response response = perform(uri);
+   m_sink = NULL;
+   return response;
+}
+
+RestClient::Response Transfer::perform(const string& uri) {
+   RestClient::Response response;
+   response.code = -1;
+   m_response = &response;
+   m_error.clear();
+
+   pthread_once(&shareOnce, initShare);
+
+   const string url = m_baseUrl + uri;
+   curl_easy_setopt(m_curl, CURLOPT_SHARE, share);
+   curl_easy_setopt(m_curl, CURLOPT_TCP_KEEPALIVE, 1L);
+   curl_easy_setopt(m_curl, CURLOPT_URL, url.c_str());
+   curl_easy_setopt(m_curl, CURLOPT_USERAGENT, "cmd/blazer");
+   curl_easy_setopt(m_curl, CURLOPT_NOSIGNAL, 1L);
+   curl_easy_setopt(m_curl, CURLOPT_WRITEFUNCTION, writeCallback);
+   curl_easy_setopt(m_curl, CURLOPT_WRITEDATA, this);
+   curl_easy_setopt(m_curl, CURLOPT_HEADERFUNCTION, headerCallback);
+   curl_easy_setopt(m_curl, CURLOPT_HEADERDATA, this);
+
+   struct curl_slist* headers = NULL;
+   for (RestClient::HeaderFields::const_iterator iter = m_headers.begin(); iter != m_headers.end(); ++iter) {
+      headers = curl_slist_append(headers, (iter->first + ": " + iter->second).c_str());
+   }
+   curl_easy_setopt(m_curl, CURLOPT_HTTPHEADER, headers);
+
+   CURLcode res = curl_easy_perform(m_curl);
+
+   long code = 0;
+   curl_easy_getinfo(m_curl, CURLINFO_RESPONSE_CODE, &code);
+
+   curl_slist_free_all(headers);
+   curl_easy_reset(m_curl);
+   m_response = NULL;
+
+   if (!m_error.empty()) {
+      throw std::runtime_error(m_error);
+   }
+   if (res != CURLE_OK) {
+      response.body = curl_easy_strerror(res);
+      response.code = (res == CURLE_OPERATION_TIMEDOUT) ? res : -1;
+   } else {
+      response.code = static_cast<int>(code);
+   }
+   return response;
+}
+
+size_t Transfer::readCallback(char* ptr, size_t size, size_t nmemb, void* userdata) {
+   Transfer* transfer = static_cast<Transfer*>(userdata);
+   try {
+      return transfer->m_source->read(ptr, size * nmemb);
+   } catch (const std::exception& err) {
+      transfer->m_error = err.what();
+      return CURL_READFUNC_ABORT;
+   }
+}
+
+size_t Transfer::writeCallback(char* ptr, size_t size, size_t nmemb, void* userdata) {
+   Transfer* transfer = static_cast<Transfer*>(userdata);
+   long code = 0;
+   if (transfer->m_sink) {
+      curl_easy_getinfo(transfer->m_curl, CURLINFO_RESPONSE_CODE, &code);
+   }
+   if (200 <= code && code <= 299) {
+      try {
+         transfer->m_sink->write(ptr, size * nmemb);
+      } catch (const std::exception& err) {
+         transfer->m_error = err.what();
+         return 0;
+      }
+   } else {
+      transfer->m_response->body.append(ptr, size * nmemb);
+   }
+   return size * nmemb;
+}
+
+size_t Transfer::headerCallback(char* ptr, size_t size, size_t nmemb, void* userdata) {
+   Transfer* transfer = static_cast<Transfer*>(userdata);
+   const string header(ptr, size * nmemb);
+   const size_t colon = header.find(':');
+   if (colon != string::npos) {
+      const size_t first = header.find_first_not_of(" \t", colon + 1);
+      const size_t last = header.find_last_not_of(" \t\r\n");
+      string value = (first != string::npos && last != string::npos && last >= first) ? header.substr(first, last - first + 1) : "";
+      transfer->m_response->headers[header.substr(0, colon)] = value;
+   }
+   return size * nmemb;
+}
+
+} // namespace khi
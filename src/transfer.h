@@ -0,0 +1,350 @@
+// vim:set et ts=3 sw=3:
+// __  __ ______ _______ _______ _______ ______ 
+// |  |/  |   __ \   |   |     __|    ___|   __ \
+// |     <|      <   |   |    |  |    ___|      <
+// |__|\__|___|__|_______|_______|_______|___|__|
+//        H E A V Y  I N D U S T R I E S
+//
+// Copyright (C) 2024 Kruger Heavy Industries
+// http://www.krugerheavyindustries.com
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty.  In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include <string>
+#include <ostream>
+#include <map>
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <curl/curl.h>
+
+#include "restclient-cpp/restclient.h"
+
+#include "coding.h"
+
+namespace khi {
+
+// Supplies a request body a chunk at a time so it never has to be held in memory.
+class Source {
+
+   public:
+
+   virtual ~Source() {}
+
+   // copy up to len bytes into buf, returning 0 once the body is exhausted
+   virtual size_t read(char* buf, size_t len) = 0;
+};
+
+// Reads a byte range of a file with pread(2), leaving no buffering of its own.
+// When given a counter every byte taken from disk is added to it.
+class FileSource : public Source {
+
+   public:
+
+   FileSource(const std::string& filepath, uint64_t offset, uint64_t length, uint64_t* bytesRead = NULL);
+
+   virtual ~FileSource();
+
+   virtual size_t read(char* buf, size_t len);
+
+   private:
+
+   FileSource(const FileSource&); // prevent copy
+   FileSource& operator=(const FileSource&); // prevent assign
+
+   const std::string m_filepath;
+   int m_fd;
+   uint64_t m_offset;
+   uint64_t m_remain;
+   uint64_t* m_bytesRead;
+};
+
+// Replays bytes already held in memory, such as a part that has been read
+// and hashed up front.
+class MemorySource : public Source {
+
+   public:
+
+   MemorySource(const char* data, size_t length);
+
+   virtual size_t read(char* buf, size_t len);
+
+   private:
+
+   const char* m_data;
+   size_t m_remain;
+};
+
+// Hashes another source as it is read and, once that source is exhausted,
+// appends the 40 hex digit SHA1 of everything that came before it. This is
+// the body layout B2 expects when X-Bz-Content-Sha1 is hex_digits_at_end.
+class Sha1Source : public Source {
+
+   public:
+
+   static const size_t TRAILER_LENGTH = 40;
+
+   explicit Sha1Source(Source& source);
+
+   virtual size_t read(char* buf, size_t len);
+
+   // hex digest of the wrapped source, empty until it has been fully read
+   inline const std::string& hash() const {
+      return m_hash;
+   }
+
+   private:
+
+   Sha1Source(const Sha1Source&); // prevent copy
+   Sha1Source& operator=(const Sha1Source&); // prevent assign
+
+   Source& m_source;
+   Sha1Digest m_digest;
+   std::string m_hash;
+   size_t m_trailerSent;
+};
+
+// Receives a response body a chunk at a time as it comes off the socket.
+class Sink {
+
+   public:
+
+   virtual ~Sink() {}
+
+   // take all of data or throw
+   virtual void write(const char* data, size_t length) = 0;
+};
+
+// Writes at increasing offsets of an already open file with pwrite(2), so
+// several sinks can fill different ranges of the same descriptor.
+class FileSink : public Sink {
+
+   public:
+
+   FileSink(int fd, uint64_t offset);
+
+   virtual void write(const char* data, size_t length);
+
+   inline uint64_t written() const {
+      return m_written;
+   }
+
+   private:
+
+   const int m_fd;
+   const uint64_t m_offset;
+   uint64_t m_written;
+};
+
+// SHA1 of a file whose ranges are written out of order by several threads.
+// Bytes arriving at the point the digest has reached are hashed straight
+// away, later ones wait in a window of at most windowBytes until the gap
+// before them is filled. Whatever the window could not hold is read back
+// from the file by finish(), so only that overflow costs a second read.
+class OrderedDigest {
+
+   public:
+
+   OrderedDigest(uint64_t totalBytes, size_t windowBytes);
+
+   ~OrderedDigest();
+
+   void update(uint64_t offset, const char* data, size_t length);
+
+   // hashes what is left from fd, which must be readable, and returns the
+   // hex digest of the whole file
+   std::string finish(int fd);
+
+   // bytes that were hashed as they arrived rather than read back
+   uint64_t hashedInline() const;
+
+   private:
+
+   OrderedDigest(const OrderedDigest&); // prevent copy
+   OrderedDigest& operator=(const OrderedDigest&); // prevent assign
+
+   void drain();
+
+   const uint64_t m_totalBytes;
+   const size_t m_windowBytes;
+   Sha1Digest m_digest;
+   uint64_t m_next;
+   uint64_t m_inline;
+   std::map<uint64_t, std::vector<char> > m_pending;
+   size_t m_pendingBytes;
+   mutable pthread_mutex_t m_mutex;
+};
+
+// Passes everything on to another sink and then to an ordered digest at the
+// offset the bytes were written to.
+class DigestSink : public Sink {
+
+   public:
+
+   DigestSink(Sink& sink, OrderedDigest& digest, uint64_t offset);
+
+   virtual void write(const char* data, size_t length);
+
+   private:
+
+   Sink& m_sink;
+   OrderedDigest& m_digest;
+   uint64_t m_offset;
+};
+
+// Passes everything on to another sink, keeping count of how much went by.
+class CountingSink : public Sink {
+
+   public:
+
+   explicit CountingSink(Sink& sink);
+
+   virtual void write(const char* data, size_t length);
+
+   inline uint64_t count() const {
+      return m_count;
+   }
+
+   private:
+
+   Sink& m_sink;
+   uint64_t m_count;
+};
+
+// Collects a response body in memory, appending to what the buffer
+// already holds so an interrupted range can be continued in place.
+class BufferSink : public Sink {
+
+   public:
+
+   explicit BufferSink(std::vector<char>& buffer);
+
+   virtual void write(const char* data, size_t length);
+
+   private:
+
+   std::vector<char>& m_buffer;
+};
+
+// Hands out range indexes to any number of fetching threads and gives the
+// fetched buffers back to a single consumer strictly in index order. At
+// most slots ranges are held at once: a range is only claimed once the one
+// slots places before it has been taken, so memory stays bounded however
+// far ahead the fastest thread gets. Claims are made in index order, which
+// with at least as many slots as fetchers means the range the consumer is
+// waiting on is always being fetched.
+class ReorderRing {
+
+   public:
+
+   ReorderRing(size_t count, size_t slots);
+
+   ~ReorderRing();
+
+   // next range to fetch, false once all are claimed or the ring failed
+   bool claim(size_t& index);
+
+   // hand over a fetched range, data is left empty
+   void commit(size_t index, std::vector<char>& data);
+
+   // next range in order, false once all are taken or the ring failed
+   bool take(std::vector<char>& data);
+
+   // wakes everyone up and stops handing out work
+   void fail();
+
+   bool failed() const;
+
+   private:
+
+   ReorderRing(const ReorderRing&); // prevent copy
+   ReorderRing& operator=(const ReorderRing&); // prevent assign
+
+   const size_t m_count;
+   std::vector<std::vector<char> > m_slots;
+   std::vector<bool> m_ready;
+   size_t m_claimed;
+   size_t m_next;
+   bool m_failed;
+   mutable pthread_mutex_t m_mutex;
+   pthread_cond_t m_condition;
+};
+
+// Writes a response body to a stream such as stdout.
+class StreamSink : public Sink {
+
+   public:
+
+   explicit StreamSink(std::ostream& strm);
+
+   virtual void write(const char* data, size_t length);
+
+   private:
+
+   std::ostream& m_strm;
+};
+
+// A single libcurl handle for requests whose bodies are streamed rather than
+// passed around as strings. Responses come back as RestClient::Response so
+// they can be validated the same way as the rest of the API calls. The
+// handle keeps its connection open between requests, so reuse one per
+// base url rather than creating one per request.
+class Transfer {
+
+   public:
+
+   explicit Transfer(const std::string& baseUrl);
+
+   ~Transfer();
+
+   void setHeaders(const RestClient::HeaderFields& headers);
+
+   RestClient::Response post(const std::string& uri, Source& source, uint64_t length);
+
+   // successful response bodies go to sink, error bodies are still returned
+   // in the response so they can be reported
+   RestClient::Response get(const std::string& uri, Sink& sink);
+
+   private:
+
+   Transfer(const Transfer&); // prevent copy
+   Transfer& operator=(const Transfer&); // prevent assign
+
+   RestClient::Response perform(const std::string& uri);
+
+   static size_t readCallback(char* ptr, size_t size, size_t nmemb, void* userdata);
+
+   static size_t writeCallback(char* ptr, size_t size, size_t nmemb, void* userdata);
+
+   static size_t headerCallback(char* ptr, size_t size, size_t nmemb, void* userdata);
+
+   const std::string m_baseUrl;
+   RestClient::HeaderFields m_headers;
+   CURL* m_curl;
+
+   Source* m_source;
+   Sink* m_sink;
+   RestClient::Response* m_response;
+   std::string m_error;
+};
+
+} // namespace khi
+#endif // TRANSFER_H
@@ -0,0 +1,139 @@
+// vim:set et ts=3 sw=3:
+// __  __ ______ _______ _______ _______ ______ 
+// |  |/  |   __ \   |   |     __|    ___|   __ \
+// |     <|      <   |   |    |  |    ___|      <
+// |__|\__|___|__|_______|_______|_______|___|__|
+//        H E A V Y  I N D U S T R I E S
+//
+// Copyright (C) 2024 Kruger Heavy Industries
+// http://www.krugerheavyindustries.com
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty.  In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+
+#include "upload_stats.h"
+
+#include <fstream>
+#include <cstdio>
+#include <time.h>
+#include <unistd.h>
+
+#include "session.h"
+
+using namespace std;
+
+namespace khi {
+
+const uint64_t UploadStats::MINIMUM_STREAM_BYTES = 1000000; // 1 MB
+const double UploadStats::SAMPLE_WEIGHT = 0.25;
+
+UploadStats::UploadStats()
+   :  m_streamBytesPerSecond(0),
+      m_callSeconds(0) {
+   pthread_mutex_init(&m_mutex, NULL);
+}
+
+UploadStats::~UploadStats() {
+   pthread_mutex_destroy(&m_mutex);
+}
+
+void UploadStats::load() {
+   double streamBytesPerSecond = 0;
+   double callSeconds = 0;
+   ifstream strm(path().c_str());
+   if (!(strm >> streamBytesPerSecond >> callSeconds) || streamBytesPerSecond < 0 || callSeconds < 0) {
+      streamBytesPerSecond = 0;
+      callSeconds = 0;
+   }
+   pthread_mutex_lock(&m_mutex);
+   m_streamBytesPerSecond = streamBytesPerSecond;
+   m_callSeconds = callSeconds;
+   pthread_mutex_unlock(&m_mutex);
+}
+
+void UploadStats::save() const {
+   pthread_mutex_lock(&m_mutex);
+   const double streamBytesPerSecond = m_streamBytesPerSecond;
+   const double callSeconds = m_callSeconds;
+   pthread_mutex_unlock(&m_mutex);
+
+   // written aside and renamed, as several uploads may finish at once
+   Session::createDirectory();
+   char tmp[32];
+   snprintf(tmp, sizeof(tmp), ".tmp.%d", static_cast<int>(getpid()));
+   const string aside = path() + tmp;
+   ofstream strm(aside.c_str());
+   strm << streamBytesPerSecond << " " << callSeconds << endl;
+   strm.close();
+   if (!strm || rename(aside.c_str(), path().c_str())) {
+      remove(aside.c_str());
+   }
+}
+
+void UploadStats::recordStream(uint64_t bytes, double seconds) {
+   if (bytes < MINIMUM_STREAM_BYTES || seconds <= 0) {
+      return;
+   }
+   pthread_mutex_lock(&m_mutex);
+   m_streamBytesPerSecond = average(m_streamBytesPerSecond, bytes / seconds);
+   pthread_mutex_unlock(&m_mutex);
+}
+
+void UploadStats::recordCall(double seconds) {
+   if (seconds <= 0) {
+      return;
+   }
+   pthread_mutex_lock(&m_mutex);
+   m_callSeconds = average(m_callSeconds, seconds);
+   pthread_mutex_unlock(&m_mutex);
+}
+
+bool UploadStats::measured() const {
+   return streamBytesPerSecond() > 0 && callSeconds() > 0;
+}
+
+double UploadStats::streamBytesPerSecond() const {
+   pthread_mutex_lock(&m_mutex);
+   const double streamBytesPerSecond = m_streamBytesPerSecond;
+   pthread_mutex_unlock(&m_mutex);
+   return streamBytesPerSecond;
+}
+
+double UploadStats::callSeconds() const {
+   pthread_mutex_lock(&m_mutex);
+   const double callSeconds = m_callSeconds;
+   pthread_mutex_unlock(&m_mutex);
+   return callSeconds;
+}
+
+double UploadStats::now() {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+string UploadStats::path() {
+   return Session::directory() + "/upload-stats";
+}
+
+double UploadStats::average(double average, double sample) {
+   // the first sample stands on its own, later ones move the average a
+   // quarter of the way so one slow transfer does not swing the threshold
+   return average > 0 ? average + SAMPLE_WEIGHT * (sample - average) : sample;
+}
+
+} // namespace khi
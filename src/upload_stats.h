@@ -0,0 +1,89 @@
+// vim:set et ts=3 sw=3:
+// __  __ ______ _______ _______ _______ ______ 
+// |  |/  |   __ \   |   |     __|    ___|   __ \
+// |     <|      <   |   |    |  |    ___|      <
+// |__|\__|___|__|_______|_______|_______|___|__|
+//        H E A V Y  I N D U S T R I E S
+//
+// Copyright (C) 2024 Kruger Heavy Industries
+// http://www.krugerheavyindustries.com
+// 
+// This software is provided 'as-is', without any express or implied
+// warranty.  In no event will the authors be held liable for any damages
+// arising from the use of this software.
+// 
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+// 
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+
+#ifndef UPLOAD_STATS_H
+#define UPLOAD_STATS_H
+
+#include <string>
+#include <stdint.h>
+#include <pthread.h>
+
+namespace khi {
+
+// Running averages of what earlier uploads from this machine measured: how
+// fast one upload stream sends and how long an API call takes to come back.
+// They are kept next to the session file so each upload starts from what
+// the ones before it saw, and the split threshold is derived from them.
+//
+//    <streamBytesPerSecond> <callSeconds>
+class UploadStats {
+
+   public:
+
+   UploadStats();
+
+   ~UploadStats();
+
+   void load();
+
+   void save() const;
+
+   // safe to call from several worker threads at once
+   void recordStream(uint64_t bytes, double seconds);
+
+   void recordCall(double seconds);
+
+   // true once both a stream and a call have been measured
+   bool measured() const;
+
+   double streamBytesPerSecond() const;
+
+   double callSeconds() const;
+
+   // a monotonic clock in seconds, for timing what is recorded
+   static double now();
+
+   private:
+
+   UploadStats(const UploadStats&); // prevent copy
+   UploadStats& operator=(const UploadStats&); // prevent assign
+
+   static std::string path();
+
+   static double average(double average, double sample);
+
+   // streams shorter than this mostly measure latency, not throughput
+   static const uint64_t MINIMUM_STREAM_BYTES;
+   static const double SAMPLE_WEIGHT;
+
+   double m_streamBytesPerSecond;
+   double m_callSeconds;
+   mutable pthread_mutex_t m_mutex;
+};
+
+} // namespace khi
+#endif // UPLOAD_STATS_H